@@ -0,0 +1,116 @@
+#ifndef ARDUINO_NATIVE_H
+#define ARDUINO_NATIVE_H
+
+/***************************************************
+  Minimal host-side stand-in for the Arduino core, used by the `native`
+  PlatformIO environment so the fingerprint library can be built and
+  exercised on a PC.
+
+  Time is virtual: millis()/micros() only move forward when delay(),
+  delayMicroseconds() or nativeAdvanceMicros() are called, so protocol
+  timings measured against the simulated sensor are deterministic and
+  independent of the host CPU. nativeRealTime() switches to the host's
+  monotonic clock for talking to real devices, e.g. over a serial port.
+ ****************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef ARDUINO
+  #define ARDUINO 10813   ///< Report a 1.x core so libraries pick the modern API
+#endif
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(const void * const *)(addr))
+#define memcpy_P memcpy
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+/// Move the virtual clock forward without sleeping
+void nativeAdvanceMicros(unsigned long us);
+/// Full 64-bit virtual time in microseconds, never wraps
+uint64_t nativeMicros64(void);
+/// Follow the host's clock (delays really sleep) or go back to virtual time; time never jumps either way
+void nativeRealTime(bool on);
+/// Have yield(), and so every delay(), call <b>hook</b>, e.g. to serve the far end of a line; NULL to stop
+void nativeSetYield(void (*hook)(void));
+
+///! Byte sink with the Arduino print helpers
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) {
+    return str ? write((const uint8_t *)str, strlen(str)) : 0;
+  }
+  virtual void flush(void) {}
+
+  size_t print(const char str[]) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println(void) { return write("\r\n"); }
+  template <typename T> size_t println(T value) {
+    size_t n = print(value);
+    return n + println();
+  }
+  template <typename T> size_t println(T value, int format) {
+    size_t n = print(value, format);
+    return n + println();
+  }
+};
+
+///! Readable byte stream, the interface the fingerprint library talks through
+class Stream : public Print {
+ public:
+  virtual int available(void) = 0;
+  virtual int read(void) = 0;
+  virtual int peek(void) = 0;
+};
+
+///! Host console port; simulated peripherals derive from it so the
+///  library's HardwareSerial constructor and begin() path can be exercised
+class HardwareSerial : public Stream {
+ public:
+  virtual void begin(unsigned long baud) { (void)baud; }
+  virtual void end(void) {}
+  virtual int available(void) { return 0; }
+  virtual int read(void) { return -1; }
+  virtual int peek(void) { return -1; }
+  virtual size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    return fwrite(buffer, 1, size, stdout);
+  }
+  using Print::write;
+  virtual void flush(void) { fflush(stdout); }
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
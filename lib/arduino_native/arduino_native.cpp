@@ -0,0 +1,114 @@
+/***************************************************
+  Host-side implementation of the Arduino core subset declared in
+  Arduino.h: a virtual clock and a stdout-backed Serial port.
+ ****************************************************/
+
+#include "Arduino.h"
+
+#include <time.h>
+
+static uint64_t virtualMicros = 0;
+static bool realTime = false;
+static uint64_t realOffset;       ///< Host clock minus the time reported, while realTime
+static void (*yieldHook)(void) = NULL;
+
+HardwareSerial Serial;
+
+static uint64_t hostMicros(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+unsigned long millis(void) {
+  return (unsigned long)(nativeMicros64() / 1000);
+}
+
+unsigned long micros(void) {
+  return (unsigned long)nativeMicros64();
+}
+
+void delay(unsigned long ms) {
+  nativeAdvanceMicros(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  nativeAdvanceMicros(us);
+}
+
+void yield(void) {
+  if (yieldHook)
+    yieldHook();
+}
+
+void nativeAdvanceMicros(unsigned long us) {
+  if (!realTime) {
+    virtualMicros += us;
+    yield();
+    return;
+  }
+  // sleep in short steps, serving the yield hook like the AVR core's delay()
+  uint64_t end = hostMicros() + us;
+  for (uint64_t now = hostMicros(); now < end; now = hostMicros()) {
+    yield();
+    uint64_t left = end - now;
+    struct timespec step = { 0, (long)(left < 100 ? left : 100) * 1000 };
+    nanosleep(&step, NULL);
+  }
+}
+
+uint64_t nativeMicros64(void) {
+  return realTime ? hostMicros() - realOffset : virtualMicros;
+}
+
+void nativeRealTime(bool on) {
+  if (on == realTime)
+    return;
+  if (on)
+    realOffset = hostMicros() - virtualMicros;
+  else
+    virtualMicros = hostMicros() - realOffset;
+  realTime = on;
+}
+
+void nativeSetYield(void (*hook)(void)) {
+  yieldHook = hook;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (write(*buffer++)) n++;
+    else break;
+  }
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  if (n < 0 && base == DEC) {
+    size_t t = print('-');
+    return t + print((unsigned long)-n, base);
+  }
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+
+  return write(str);
+}
+
+size_t Print::print(double n, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
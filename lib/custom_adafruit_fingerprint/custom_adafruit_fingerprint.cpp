@@ -16,27 +16,46 @@
 
 #include "custom_adafruit_fingerprint.h"
 
-//#define FINGERPRINT_DEBUG
+///! Decoder position in a run-length coded PROGMEM template
+struct RleCursor {
+  const uint8_t *next;      ///< Next coded byte
+  uint8_t count;            ///< Bytes left in the current run or literal block
+  uint8_t value;            ///< Byte being repeated
+  boolean run;              ///< Current block is a run rather than literals
+};
+
+///! An exportLibrary() record being written
+struct ExportRecord {
+  Print *out;               ///< Where the record goes
+  uint16_t sum;             ///< Running sum of slot and template bytes
+};
 
-#if ARDUINO >= 100
-  #define SERIAL_WRITE(...) mySerial->write(__VA_ARGS__)
+// Frames are assembled in RAM and handed to the UART in bulk
+#ifdef FINGERPRINT_TRACE
+#define SERIAL_WRITE_BUF(buf, len) do { \
+    traceBytes(FINGERPRINT_TRACE_TX, (const uint8_t *)(buf), len); \
+    mySerial->write((const uint8_t *)(buf), len); \
+  } while (0)
 #else
-  #define SERIAL_WRITE(...) mySerial->write(__VA_ARGS__, BYTE)
+#define SERIAL_WRITE_BUF(buf, len) mySerial->write((const uint8_t *)(buf), len)
 #endif
+#define SERIAL_READ() received(mySerial->read())
 
-#define SERIAL_WRITE_U16(v) SERIAL_WRITE((uint8_t)(v>>8)); SERIAL_WRITE((uint8_t)(v & 0xFF));
-
-#define GET_CMD_PACKET(...) \
-  uint8_t data[] = {__VA_ARGS__}; \
-  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data); \
-  writeStructuredPacket(packet); \
-  if (getStructuredPacket(&packet) != FINGERPRINT_OK) return FINGERPRINT_PACKETRECIEVEERR; \
-  if (packet.type != FINGERPRINT_ACKPACKET) return FINGERPRINT_PACKETRECIEVEERR;
+// A drainTrace() block: magic, entry count and entries lost, then the entries
+static void writeTraceHeader(Print &out, uint16_t count, uint16_t lost) {
+  uint8_t header[] = { FINGERPRINT_TRACEMAGIC,
+                       (uint8_t)(count >> 8), (uint8_t)(count & 0xFF),
+                       (uint8_t)(lost >> 8), (uint8_t)(lost & 0xFF) };
+  out.write(header, sizeof(header));
+}
 
-#define SEND_CMD_PACKET(...) GET_CMD_PACKET(__VA_ARGS__); return packet.data[0];
+static void writeTraceEntry(Print &out, const Adafruit_Fingerprint_TraceEntry &e) {
+  uint8_t record[] = { (uint8_t)(e.time >> 24), (uint8_t)(e.time >> 16),
+                       (uint8_t)(e.time >> 8), (uint8_t)(e.time & 0xFF),
+                       e.kind, e.value };
+  out.write(record, sizeof(record));
+}
 
-//SEND_CMD_PACKET(FINGERPRINT_STORE, 0x01, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF));
-//SEND_CMD_PACKET(FINGERPRINT_UPLOAD, 0x01);
 /***************************************************************************
  PUBLIC FUNCTIONS
  ***************************************************************************/
@@ -51,10 +70,7 @@
 */
 /**************************************************************************/
 Adafruit_Fingerprint::Adafruit_Fingerprint(SoftwareSerial *ss, uint32_t password) {
-  thePassword = password;
-  theAddress = 0xFFFFFFFF;
-
-  hwSerial = NULL;
+  init(password);
   swSerial = ss;
   mySerial = swSerial;
 }
@@ -69,14 +85,65 @@ Adafruit_Fingerprint::Adafruit_Fingerprint(SoftwareSerial *ss, uint32_t password
 */
 /**************************************************************************/
 Adafruit_Fingerprint::Adafruit_Fingerprint(HardwareSerial *hs, uint32_t password) {
+  init(password);
+  hwSerial = hs;
+  mySerial = hwSerial;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Instantiates sensor on any Stream, e.g. an Adafruit_Fingerprint_Recorder
+            or Adafruit_Fingerprint_Replay. begin() cannot set the rate of a
+            plain Stream, so open the port before using the sensor.
+    @param  serial Pointer to the Stream the sensor is reached through
+    @param  password 32-bit integer password (default is 0)
+*/
+/**************************************************************************/
+Adafruit_Fingerprint::Adafruit_Fingerprint(Stream *serial, uint32_t password) {
+  init(password);
+  mySerial = serial;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Instantiates sensor on a transport the library can open and
+            re-time itself, e.g. one from lib/fingerprint_transport
+    @param  line Pointer to the transport the sensor is connected to
+    @param  password 32-bit integer password (default is 0)
+*/
+/**************************************************************************/
+Adafruit_Fingerprint::Adafruit_Fingerprint(Adafruit_Fingerprint_Transport *line, uint32_t password) {
+  init(password);
+  transport = line;
+  mySerial = transport;
+}
+
+void Adafruit_Fingerprint::init(uint32_t password) {
   thePassword = password;
-  theAddress = 0xFFFFFFFF;
+  theAddress = FINGERPRINT_DEFAULTADDRESS;
+  packetLength = FINGERPRINT_DEFAULTPACKETSIZE;
+  baudRate = 0;
+  capacity = 0;
+  autoIdentify = true;
+  autoIdentifyKnown = false;
+  identifyTimeouts = 0;
+  reservedFirst = reservedCount = 0;
+  reservedCopyOf = NULL;
+  commandState = FINGERPRINT_OK;
+  commandResult = FINGERPRINT_OK;
+  callback = NULL;
+#ifdef FINGERPRINT_STATS
+  resetStats();
+#endif
+#ifdef FINGERPRINT_TRACE
+  traceHead = traceCount = traceLost = 0;
+#endif
 
 #if defined(__AVR__) || defined(ESP8266) || defined(FREEDOM_E300_HIFIVE1)
   swSerial = NULL;
 #endif
-  hwSerial = hs;
-  mySerial = hwSerial;
+  hwSerial = NULL;
+  transport = NULL;
 }
 
 /**************************************************************************/
@@ -88,10 +155,171 @@ Adafruit_Fingerprint::Adafruit_Fingerprint(HardwareSerial *hs, uint32_t password
 void Adafruit_Fingerprint::begin(uint32_t baudrate) {
   delay(1000);  // one second delay to let the sensor 'boot up'
 
+  openSerial(baudrate);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Initializes the serial interface at whatever rate the sensor
+            answers on, then moves the sensor up to a faster rate if asked,
+            and reads its system parameters (see getParameters()).
+            Note the new rate is saved in the sensor's flash, and that
+            SoftwareSerial is unreliable above 57600 on 16MHz AVRs.
+    @param  baudrate Rate to try first (usually 57600)
+    @param  maxBaudrate Rate to switch the sensor to once found, or 0 to leave it as is
+    @returns The rate now in use, or 0 if the sensor did not answer at any rate
+*/
+/**************************************************************************/
+uint32_t Adafruit_Fingerprint::begin(uint32_t baudrate, uint32_t maxBaudrate) {
+  delay(1000);  // one second delay to let the sensor 'boot up'
+
+  uint32_t found = detectBaudRate(baudrate);
+  if (found && maxBaudrate > found) {
+    if (setBaudRate(maxBaudrate) != FINGERPRINT_OK || !probeBaudRate(maxBaudrate)) {
+      // the switch did not take, fall back to the rate we know works
+      if (!probeBaudRate(found) && !detectBaudRate(found))
+        return 0;
+    }
+  }
+  if (found)
+    getParameters();
+  return baudRate;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Find the UART rate the sensor is configured for by sending
+            VerifyPassword at each standard R30x rate (N x 9600, N = 1..12)
+            until one is answered. The port is left open at that rate.
+    @param  first Rate to try before the others
+    @returns The detected rate, or 0 if the sensor did not answer at any rate
+*/
+/**************************************************************************/
+uint32_t Adafruit_Fingerprint::detectBaudRate(uint32_t first) {
+  // most likely settings first: factory default, maximum, then the rest
+  static const uint8_t order[] = { 6, 12, 1, 2, 4, 3, 5, 7, 8, 9, 10, 11 };
+
+  if (first && probeBaudRate(first))
+    return baudRate;
+  for (uint8_t i=0; i<sizeof(order); i++) {
+    uint32_t rate = (uint32_t)order[i] * FINGERPRINT_BAUDRATE_STEP;
+    if (rate != first && probeBaudRate(rate))
+      return baudRate;
+  }
+  baudRate = 0;
+  return 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Switch the sensor to another UART rate and reopen our side to match
+    @param  baudrate New rate, a multiple of 9600 up to 115200
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_INVALIDREG</code> if the rate is not one the sensor supports
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::setBaudRate(uint32_t baudrate) {
+  if (baudrate == 0 || baudrate > FINGERPRINT_BAUDRATE_MAX || baudrate % FINGERPRINT_BAUDRATE_STEP)
+    return FINGERPRINT_INVALIDREG;
+
+  uint8_t p = writeRegister(FINGERPRINT_BAUD_REG_ADDR, baudrate / FINGERPRINT_BAUDRATE_STEP);
+  if (p != FINGERPRINT_OK)
+    return p;
+
+  // the sensor acknowledges at the old rate, then switches
+  delay(10);
+  openSerial(baudrate);
+  return FINGERPRINT_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Write one of the sensor's system parameters (SetSysPara)
+    @param  reg Parameter number, e.g. FINGERPRINT_BAUD_REG_ADDR
+    @param  value New value
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_INVALIDREG</code> if the sensor does not know the parameter
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::writeRegister(uint8_t reg, uint8_t value) {
+  uint8_t params[] = { reg, value };
+  return runCommand<FINGERPRINT_SETSYSPARA>(params);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Read the sensor's system parameters (ReadSysPara) into
+            <b>statusRegister</b>, <b>systemID</b>, <b>capacity</b>,
+            <b>securityLevel</b>, <b>deviceAddress</b> and <b>packetLength</b>
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::getParameters(void) {
+  uint8_t p = runCommand<FINGERPRINT_READSYSPARA>();
+  if (p != FINGERPRINT_OK)
+    return p;
+
+  const Adafruit_Fingerprint_SizedPacket<FINGERPRINT_REPLYSIZE> &packet = reply;
+  statusRegister = ((uint16_t)packet.data[1] << 8) | packet.data[2];
+  systemID = ((uint16_t)packet.data[3] << 8) | packet.data[4];
+  capacity = ((uint16_t)packet.data[5] << 8) | packet.data[6];
+  securityLevel = ((uint16_t)packet.data[7] << 8) | packet.data[8];
+  deviceAddress = ((uint32_t)packet.data[9] << 24) | ((uint32_t)packet.data[10] << 16) |
+                  ((uint32_t)packet.data[11] << 8) | packet.data[12];
+  packetLength = FINGERPRINT_MINPACKETSIZE << (packet.data[14] & 0x03);
+
+  return FINGERPRINT_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Change the sensor's data packet size (SetSysPara). Larger packets
+            mean fewer headers and checksums per template or image transfer;
+            downloads and uploads follow the new size from here on.
+    @param  bytes Payload per data packet: 32, 64, 128 or 256
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_INVALIDREG</code> if the size is not one the sensor supports
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::setPacketSize(uint16_t bytes) {
+  uint8_t code = 0;
+  while ((FINGERPRINT_MINPACKETSIZE << code) < bytes && code < 3)
+    code++;
+  if ((FINGERPRINT_MINPACKETSIZE << code) != bytes)
+    return FINGERPRINT_INVALIDREG;
+
+  uint8_t p = writeRegister(FINGERPRINT_PACKET_REG_ADDR, code);
+  if (p == FINGERPRINT_OK)
+    packetLength = bytes;
+  return p;
+}
+
+void Adafruit_Fingerprint::openSerial(uint32_t baudrate) {
   if (hwSerial) hwSerial->begin(baudrate);
+  if (transport) transport->begin(baudrate);
 #if defined(__AVR__) || defined(ESP8266) || defined(FREEDOM_E300_HIFIVE1)
   if (swSerial) swSerial->begin(baudrate);
 #endif
+  baudRate = baudrate;
+}
+
+boolean Adafruit_Fingerprint::probeBaudRate(uint32_t baudrate) {
+  openSerial(baudrate);
+  while (mySerial->available())
+    SERIAL_READ();
+
+  uint8_t data[] = {FINGERPRINT_VERIFYPASSWORD,
+                    (uint8_t)(thePassword >> 24), (uint8_t)(thePassword >> 16),
+                    (uint8_t)(thePassword >> 8), (uint8_t)(thePassword & 0xFF)};
+  Adafruit_Fingerprint_SizedPacket<sizeof(data)> packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+  writeStructuredPacket(packet);
+  // any well-formed answer, even a wrong-password one, means the rate is right
+  return getStructuredPacket(&reply, FINGERPRINT_PROBETIMEOUT) == FINGERPRINT_OK &&
+         reply.type == FINGERPRINT_ACKPACKET;
 }
 
 /**************************************************************************/
@@ -105,10 +333,9 @@ boolean Adafruit_Fingerprint::verifyPassword(void) {
 }
 
 uint8_t Adafruit_Fingerprint::checkPassword(void) {
-  GET_CMD_PACKET(FINGERPRINT_VERIFYPASSWORD,
-                  (uint8_t)(thePassword >> 24), (uint8_t)(thePassword >> 16),
-                  (uint8_t)(thePassword >> 8), (uint8_t)(thePassword & 0xFF));
-  if (packet.data[0] == FINGERPRINT_OK)
+  uint8_t params[] = { (uint8_t)(thePassword >> 24), (uint8_t)(thePassword >> 16),
+                       (uint8_t)(thePassword >> 8), (uint8_t)(thePassword & 0xFF) };
+  if (runCommand<FINGERPRINT_VERIFYPASSWORD>(params) == FINGERPRINT_OK)
     return FINGERPRINT_OK;
   else
     return FINGERPRINT_PACKETRECIEVEERR;
@@ -124,7 +351,19 @@ uint8_t Adafruit_Fingerprint::checkPassword(void) {
 */
 /**************************************************************************/
 uint8_t Adafruit_Fingerprint::getImage(void) {
-  SEND_CMD_PACKET(FINGERPRINT_GETIMAGE);
+  finishPending();
+  return waitForResult(beginGetImage());
+}
+
+/**************************************************************************/
+/*!
+    @brief   Start getImage() without waiting; follow up with poll()
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginGetImage(void) {
+  return startCommand<FINGERPRINT_GETIMAGE>();
 }
 
 /**************************************************************************/
@@ -138,7 +377,21 @@ uint8_t Adafruit_Fingerprint::getImage(void) {
     @returns <code>FINGERPRINT_INVALIDIMAGE</code> on failure to identify fingerprint features
 */
 uint8_t Adafruit_Fingerprint::image2Tz(uint8_t slot) {
-  SEND_CMD_PACKET(FINGERPRINT_IMAGE2TZ,slot);
+  finishPending();
+  return waitForResult(beginImage2Tz(slot));
+}
+
+/**************************************************************************/
+/*!
+    @brief   Start image2Tz() without waiting; follow up with poll()
+    @param   slot Location to place feature template
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginImage2Tz(uint8_t slot) {
+  uint8_t params[] = { slot };
+  return startCommand<FINGERPRINT_IMAGE2TZ>(params);
 }
 
 /**************************************************************************/
@@ -149,7 +402,7 @@ uint8_t Adafruit_Fingerprint::image2Tz(uint8_t slot) {
     @returns <code>FINGERPRINT_ENROLLMISMATCH</code> on mismatch of fingerprints
 */
 uint8_t Adafruit_Fingerprint::createModel(void) {
-  SEND_CMD_PACKET(FINGERPRINT_REGMODEL);
+  return runCommand<FINGERPRINT_REGMODEL>();
 }
 
 
@@ -157,25 +410,57 @@ uint8_t Adafruit_Fingerprint::createModel(void) {
 /*!
     @brief   Ask the sensor to store the calculated model for later matching
     @param   location The model location #
+    @param   slot Char buffer to store, 1 or 2
     @returns <code>FINGERPRINT_OK</code> on success
     @returns <code>FINGERPRINT_BADLOCATION</code> if the location is invalid
     @returns <code>FINGERPRINT_FLASHERR</code> if the model couldn't be written to flash memory
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
-uint8_t Adafruit_Fingerprint::storeModel(uint16_t location) {
-  SEND_CMD_PACKET(FINGERPRINT_STORE, 0x01, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF));
+uint8_t Adafruit_Fingerprint::storeModel(uint16_t location, uint8_t slot) {
+  finishPending();
+  return waitForResult(beginStoreModel(location, slot));
 }
 
 /**************************************************************************/
 /*!
-    @brief   Ask the sensor to load a fingerprint model from flash into buffer 1
+    @brief   Start storeModel() without waiting; follow up with poll()
     @param   location The model location #
+    @param   slot Char buffer to store, 1 or 2
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginStoreModel(uint16_t location, uint8_t slot) {
+  uint8_t params[] = { slot, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF) };
+  return startCommand<FINGERPRINT_STORE>(params);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Ask the sensor to load a fingerprint model from flash into a char buffer
+    @param   location The model location #
+    @param   slot Char buffer to load into, 1 or 2
     @returns <code>FINGERPRINT_OK</code> on success
     @returns <code>FINGERPRINT_BADLOCATION</code> if the location is invalid
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
-uint8_t Adafruit_Fingerprint::loadModel(uint16_t location) {
-  SEND_CMD_PACKET(FINGERPRINT_LOAD, 0x01, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF));
+uint8_t Adafruit_Fingerprint::loadModel(uint16_t location, uint8_t slot) {
+  finishPending();
+  return waitForResult(beginLoadModel(location, slot));
+}
+
+/**************************************************************************/
+/*!
+    @brief   Start loadModel() without waiting; follow up with poll()
+    @param   location The model location #
+    @param   slot Char buffer to load into, 1 or 2
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginLoadModel(uint16_t location, uint8_t slot) {
+  uint8_t params[] = { slot, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF) };
+  return startCommand<FINGERPRINT_LOAD>(params);
 }
 
 /**************************************************************************/
@@ -185,20 +470,37 @@ uint8_t Adafruit_Fingerprint::loadModel(uint16_t location) {
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
 uint8_t Adafruit_Fingerprint::getModel(void) {
-  SEND_CMD_PACKET(FINGERPRINT_UPLOAD, 0x01);
+  return runCommand<FINGERPRINT_UPLOAD, 0x01>();
 }
 
 /**************************************************************************/
 /*!
     @brief   Ask the sensor to delete a model in memory
     @param   location The model location #
+    @param   count Number of consecutive models to delete, one command for all
     @returns <code>FINGERPRINT_OK</code> on success
     @returns <code>FINGERPRINT_BADLOCATION</code> if the location is invalid
     @returns <code>FINGERPRINT_FLASHERR</code> if the model couldn't be written to flash memory
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
-uint8_t Adafruit_Fingerprint::deleteModel(uint16_t location) {
-  SEND_CMD_PACKET(FINGERPRINT_DELETE, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF), 0x00, 0x01);
+uint8_t Adafruit_Fingerprint::deleteModel(uint16_t location, uint16_t count) {
+  finishPending();
+  return waitForResult(beginDeleteModel(location, count));
+}
+
+/**************************************************************************/
+/*!
+    @brief   Start deleteModel() without waiting; follow up with poll()
+    @param   location The model location #
+    @param   count Number of consecutive models to delete
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginDeleteModel(uint16_t location, uint16_t count) {
+  uint8_t params[] = { (uint8_t)(location >> 8), (uint8_t)(location & 0xFF),
+                       (uint8_t)(count >> 8), (uint8_t)(count & 0xFF) };
+  return startCommand<FINGERPRINT_DELETE>(params);
 }
 
 /**************************************************************************/
@@ -210,32 +512,166 @@ uint8_t Adafruit_Fingerprint::deleteModel(uint16_t location) {
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
 uint8_t Adafruit_Fingerprint::emptyDatabase(void) {
-  SEND_CMD_PACKET(FINGERPRINT_EMPTY);
+  return runCommand<FINGERPRINT_EMPTY>();
 }
 
 /**************************************************************************/
 /*!
-    @brief   Ask the sensor to search the current slot 1 fingerprint features to match saved templates. The matching location is stored in <b>fingerID</b> and the matching confidence in <b>confidence</b>
+    @brief   Ask the sensor to compare the features in char buffers 1 and 2. The
+             score is stored in <b>confidence</b>.
+    @returns <code>FINGERPRINT_OK</code> if they belong to the same finger
+    @returns <code>FINGERPRINT_NOMATCH</code> if they don't
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::getMatch(void) {
+  finishPending();
+  return waitForResult(beginMatch());
+}
+
+/**************************************************************************/
+/*!
+    @brief   Start getMatch() without waiting; follow up with poll().
+             <b>confidence</b> is set when it completes.
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginMatch(void) {
+  return startCommand<FINGERPRINT_MATCH>();
+}
+
+/**************************************************************************/
+/*!
+    @brief   Check the finger on the sensor against one claimed template, e.g.
+             the one a badge points to. A 1:1 MATCH costs the same whatever
+             the library size, where a search grows with it. Uses both char
+             buffers. On success <b>fingerID</b> is set to <b>id</b> and
+             <b>confidence</b> to the match score.
+    @param   id The claimed template's page
+    @returns <code>FINGERPRINT_OK</code> if the finger matches the template
+    @returns <code>FINGERPRINT_NOMATCH</code> if it doesn't
+    @returns <code>FINGERPRINT_NOFINGER</code> or another getImage(), image2Tz()
+             or loadModel() code when one of those steps fails
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::verify(uint16_t id) {
+  uint8_t p = getImage();
+  if (p == FINGERPRINT_OK)
+    p = image2Tz(1);
+  if (p == FINGERPRINT_OK)
+    p = loadModel(id, 2);
+  if (p == FINGERPRINT_OK)
+    p = getMatch();
+  if (p == FINGERPRINT_OK)
+    fingerID = id;
+  return p;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Take an image, extract its features and search the whole library
+             in one round trip with the module's Identify command, instead
+             of getImage(), image2Tz() and fingerFastSearch(). Modules that
+             reject Identify get those three from then on; the first call on
+             such a module pays for the rejected command. Only an intact ACK
+             refusing it counts; a reply damaged on the line is returned as
+             FINGERPRINT_PACKETRECIEVEERR and Identify is tried again.
+             Firmware that ignores the command and sends nothing costs a
+             reply timeout per call, returned as FINGERPRINT_PACKETRECIEVEERR,
+             until FINGERPRINT_IDENTIFYTIMEOUTS calls in a row have timed out
+             without Identify ever being answered; that call and the later
+             ones use the three commands.
+    @returns <code>FINGERPRINT_OK</code> on a match, with <b>fingerID</b> and <b>confidence</b> set
+    @returns <code>FINGERPRINT_NOFINGER</code>, <code>FINGERPRINT_NOTFOUND</code>
+             or another code from the step that failed
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::identify(void) {
+  uint8_t p;
+  if (autoIdentify) {
+    p = runCommand<FINGERPRINT_IDENTIFY>();
+    if (p != FINGERPRINT_PACKETRECIEVEERR)
+      autoIdentifyKnown = true;
+    // a well-formed refusal before the module ever took the command means
+    // it lacks it, and so does silence that keeps up; a damaged reply
+    // tells nothing
+    boolean silent = p == FINGERPRINT_PACKETRECIEVEERR && commandState == FINGERPRINT_TIMEOUT;
+    identifyTimeouts = silent && identifyTimeouts < 0xFF ? identifyTimeouts + 1 : 0;
+    boolean refused = p == FINGERPRINT_PACKETRECIEVEERR && commandState == FINGERPRINT_OK;
+    if (autoIdentifyKnown || !(refused || identifyTimeouts >= FINGERPRINT_IDENTIFYTIMEOUTS))
+      return p;
+    autoIdentify = false;
+  }
+
+  p = getImage();
+  if (p == FINGERPRINT_OK)
+    p = image2Tz(1);
+  if (p == FINGERPRINT_OK)
+    p = fingerFastSearch();
+  return p;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Ask the sensor to search the current slot 1 fingerprint features to match saved templates. The matching location is stored in <b>fingerID</b> and the matching confidence in <b>confidence</b>.
+             The whole library is searched; its size is read with getParameters() the first time if not known yet.
     @returns <code>FINGERPRINT_OK</code> on fingerprint match success
     @returns <code>FINGERPRINT_NOTFOUND</code> no match made
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
 /**************************************************************************/
 uint8_t Adafruit_Fingerprint::fingerFastSearch(void) {
-  // high speed search of slot #1 starting at page 0x0000 and page #0x00A3
-  GET_CMD_PACKET(FINGERPRINT_HISPEEDSEARCH, 0x01, 0x00, 0x00, 0x00, 0xA3);
-  fingerID = 0xFFFF;
-  confidence = 0xFFFF;
+  finishPending();
+  if (!capacity)
+    getParameters();
+  return waitForResult(beginSearch());
+}
 
-  fingerID = packet.data[1];
-  fingerID <<= 8;
-  fingerID |= packet.data[2];
+/**************************************************************************/
+/*!
+    @brief   Ask the sensor to search part of the library for the features in
+             a char buffer. Search time grows with the number of pages
+             covered, so limiting it to the used range or to a partition
+             answers sooner.
+    @param   start First page to compare against
+    @param   count Number of pages to compare against
+    @param   slot Char buffer holding the features, 1 or 2
+    @returns See fingerFastSearch()
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::search(uint16_t start, uint16_t count, uint8_t slot) {
+  finishPending();
+  return waitForResult(beginSearch(start, count, slot));
+}
 
-  confidence = packet.data[3];
-  confidence <<= 8;
-  confidence |= packet.data[4];
+/**************************************************************************/
+/*!
+    @brief   Start fingerFastSearch() without waiting; follow up with poll().
+             <b>fingerID</b> and <b>confidence</b> are set when it completes.
+             Covers <b>capacity</b> pages, or the first 163 when that is not known.
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginSearch(void) {
+  return beginSearch(0, capacity ? capacity : FINGERPRINT_DEFAULTCAPACITY, 1);
+}
 
-  return packet.data[0];
+/**************************************************************************/
+/*!
+    @brief   Start search() without waiting; follow up with poll()
+    @param   start First page to compare against
+    @param   count Number of pages to compare against
+    @param   slot Char buffer holding the features, 1 or 2
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginSearch(uint16_t start, uint16_t count, uint8_t slot) {
+  uint8_t params[] = { slot, (uint8_t)(start >> 8), (uint8_t)(start & 0xFF),
+                       (uint8_t)(count >> 8), (uint8_t)(count & 0xFF) };
+  return startCommand<FINGERPRINT_HISPEEDSEARCH>(params);
 }
 
 /**************************************************************************/
@@ -246,13 +682,294 @@ uint8_t Adafruit_Fingerprint::fingerFastSearch(void) {
 */
 /**************************************************************************/
 uint8_t Adafruit_Fingerprint::getTemplateCount(void) {
-  GET_CMD_PACKET(FINGERPRINT_TEMPLATECOUNT);
+  finishPending();
+  return waitForResult(beginTemplateCount());
+}
 
-  templateCount = packet.data[1];
-  templateCount <<= 8;
-  templateCount |= packet.data[2];
+/**************************************************************************/
+/*!
+    @brief   Start getTemplateCount() without waiting; follow up with poll().
+             <b>templateCount</b> is set when it completes.
+    @returns <code>FINGERPRINT_OK</code> if the command was sent
+    @returns <code>FINGERPRINT_BUSY</code> if another command is still in flight
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::beginTemplateCount(void) {
+  return startCommand<FINGERPRINT_TEMPLATECOUNT>();
+}
 
-  return packet.data[0];
+/**************************************************************************/
+/*!
+    @brief   Read one page of the module's index table (ReadIndexTable): a
+             bitmap of which library pages hold a template, so free and used
+             pages can be found without probing each one
+    @param   table Which 256 pages: 0 covers 0-255, 1 covers 256-511 and so on
+    @param   bitmap FINGERPRINT_INDEXTABLESIZE bytes to fill; bit <b>i</b> of
+             byte <b>j</b> is set when page table * 256 + j * 8 + i is used
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error, or from modules without the command
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::readIndexTable(uint8_t table, uint8_t *bitmap) {
+  uint8_t params[] = { table };
+  uint8_t p = runCommand<FINGERPRINT_READINDEX>(params);
+  if (p != FINGERPRINT_OK)
+    return p;
+  memcpy(bitmap, reply.data + 1, FINGERPRINT_INDEXTABLESIZE);
+  return FINGERPRINT_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Drive the command started by one of the begin...() calls: read
+             whatever reply bytes have arrived and, once the ACK is complete,
+             decode it and fire the callback. Never blocks, so call it from
+             loop() as often as convenient.
+    @returns <code>FINGERPRINT_BUSY</code> while the command is in flight
+    @returns Otherwise the result of the last command, exactly as its
+             blocking counterpart would have returned it
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::poll(void) {
+  if (commandState != FINGERPRINT_BUSY)
+    return commandResult;
+
+  uint8_t p = receiveReply();
+  if (p == FINGERPRINT_BUSY)
+    return FINGERPRINT_BUSY;
+
+  commandState = countFailure(p);
+  if (p != FINGERPRINT_OK) {
+    commandResult = FINGERPRINT_PACKETRECIEVEERR;
+  } else {
+#ifdef FINGERPRINT_STATS
+    recordLatency(commandOpcode, micros() - commandMicros);
+#endif
+    commandResult = reply.data[0];
+    switch (commandOpcode) {
+      case FINGERPRINT_HISPEEDSEARCH:
+      case FINGERPRINT_IDENTIFY:
+        fingerID = homePage(((uint16_t)reply.data[1] << 8) | reply.data[2]);
+        confidence = ((uint16_t)reply.data[3] << 8) | reply.data[4];
+        break;
+      case FINGERPRINT_MATCH:
+        confidence = ((uint16_t)reply.data[1] << 8) | reply.data[2];
+        break;
+      case FINGERPRINT_TEMPLATECOUNT:
+        templateCount = ((uint16_t)reply.data[1] << 8) | reply.data[2];
+        for (uint16_t i = 0; reservedCopyOf && i < reservedCount; i++)
+          if (reservedCopyOf[i] != FINGERPRINT_NOPAGE && templateCount)
+            templateCount--;
+        break;
+    }
+  }
+
+  if (callback)
+    callback(commandOpcode, commandResult, callbackContext);
+  return commandResult;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Result of the last command without reading the UART
+    @returns <code>FINGERPRINT_BUSY</code> while a command is in flight, else what poll() returned for it
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::status(void) {
+  return commandState == FINGERPRINT_BUSY ? FINGERPRINT_BUSY : commandResult;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Have poll() report every completed command, blocking ones included
+    @param   cb Called with the command code and its result, or NULL to stop
+    @param   context Passed through to <b>cb</b>
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint::setCallback(Adafruit_Fingerprint_Callback cb, void *context) {
+  callback = cb;
+  callbackContext = context;
+}
+
+#ifdef FINGERPRINT_STATS
+/**************************************************************************/
+/*!
+    @brief   Dump <b>stats</b> in a compact text form: the error counters, then
+             one line per command code with its count, slowest time and
+             histogram, for a script to pick up from the debug port
+    @param   out Where to print, e.g. Serial
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint::printStats(Print &out) {
+  out.println("# timeouts badpackets resyncs");
+  out.print(stats.timeouts); out.print(' ');
+  out.print(stats.badPackets); out.print(' ');
+  out.println(stats.resyncs);
+  out.print("# cmd count max_us, then counts under ");
+  out.print(FINGERPRINT_STATSBASE);
+  out.println("us doubling per bucket");
+  for (uint8_t i = 0; i < FINGERPRINT_STATSCOMMANDS && stats.commands[i].opcode; i++) {
+    const Adafruit_Fingerprint_CommandStats &c = stats.commands[i];
+    out.print("0x");
+    if (c.opcode < 0x10) out.print('0');
+    out.print(c.opcode, HEX); out.print(' ');
+    out.print(c.count); out.print(' ');
+    out.print(c.maxMicros);
+    for (uint8_t b = 0; b < FINGERPRINT_STATSBUCKETS; b++) {
+      out.print(' ');
+      out.print(c.buckets[b]);
+    }
+    out.println();
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief   Zero all counters and histograms
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint::resetStats(void) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+uint8_t Adafruit_Fingerprint::countFailure(uint8_t p) {
+  if (p == FINGERPRINT_TIMEOUT && stats.timeouts != 0xFFFF)
+    stats.timeouts++;
+  else if (p == FINGERPRINT_BADPACKET && stats.badPackets != 0xFFFF)
+    stats.badPackets++;
+  return p;
+}
+
+void Adafruit_Fingerprint::recordLatency(uint8_t opcode, uint32_t elapsed) {
+  uint8_t i = 0;
+  while (i < FINGERPRINT_STATSCOMMANDS && stats.commands[i].opcode && stats.commands[i].opcode != opcode)
+    i++;
+  if (i == FINGERPRINT_STATSCOMMANDS)
+    return;   // table full, only the first command codes are tracked
+
+  Adafruit_Fingerprint_CommandStats &c = stats.commands[i];
+  c.opcode = opcode;
+  uint8_t b = 0;
+  for (uint32_t limit = FINGERPRINT_STATSBASE; b < FINGERPRINT_STATSBUCKETS - 1 && elapsed >= limit; limit <<= 1)
+    b++;
+  // saturate rather than wrap, so a long-running count stays meaningful
+  if (c.buckets[b] != 0xFFFF)
+    c.buckets[b]++;
+  if (c.count != 0xFFFF)
+    c.count++;
+  if (elapsed > c.maxMicros)
+    c.maxMicros = elapsed;
+}
+#endif
+
+#ifdef FINGERPRINT_TRACE
+/**************************************************************************/
+/*!
+    @brief   Send the recorded UART traffic out as one binary block and empty
+             the buffer: FINGERPRINT_TRACEMAGIC, entry count (2 bytes),
+             entries lost to overwriting (2 bytes), then the entries oldest
+             first, see Adafruit_Fingerprint_TraceEntry. All numbers MSB
+             first; tools/trace_decode.py prints the frames they hold.
+             Call it when the sensor is idle, e.g. after a failed unlock.
+    @param   out Where to write, e.g. Serial
+    @returns The number of entries written
+*/
+/**************************************************************************/
+uint16_t Adafruit_Fingerprint::drainTrace(Print &out) {
+  writeTraceHeader(out, traceCount, traceLost);
+
+  uint16_t count = traceCount;
+  uint16_t i = (traceHead + FINGERPRINT_TRACESIZE - count) % FINGERPRINT_TRACESIZE;
+  for (uint16_t n = 0; n < count; n++) {
+    writeTraceEntry(out, traceBuffer[i]);
+    i = (i + 1) % FINGERPRINT_TRACESIZE;
+  }
+  traceCount = traceLost = 0;
+  return count;
+}
+
+void Adafruit_Fingerprint::trace(uint8_t kind, uint8_t value) {
+  Adafruit_Fingerprint_TraceEntry &e = traceBuffer[traceHead];
+  e.time = micros();
+  e.kind = kind;
+  e.value = value;
+  traceHead = (traceHead + 1) % FINGERPRINT_TRACESIZE;
+  if (traceCount < FINGERPRINT_TRACESIZE)
+    traceCount++;
+  else if (traceLost != 0xFFFF)
+    traceLost++;
+}
+
+void Adafruit_Fingerprint::traceBytes(uint8_t kind, const uint8_t *data, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++)
+    trace(kind, data[i]);
+}
+
+uint8_t Adafruit_Fingerprint::traceRead(int value) {
+  trace(FINGERPRINT_TRACE_RX, (uint8_t)value);
+  return (uint8_t)value;
+}
+#endif
+
+uint8_t Adafruit_Fingerprint::sendCommand(uint8_t *frame, uint8_t size, uint16_t sum, const uint8_t *params, uint8_t count) {
+  if (commandState == FINGERPRINT_BUSY)
+    return FINGERPRINT_BUSY;
+
+  frame[2] = (uint8_t)(theAddress >> 24);
+  frame[3] = (uint8_t)(theAddress >> 16);
+  frame[4] = (uint8_t)(theAddress >> 8);
+  frame[5] = (uint8_t)(theAddress & 0xFF);
+  uint8_t *p = frame + size - 2 - count;
+  for (uint8_t i=0; i<count; i++) {
+    *p++ = params[i];
+    sum += params[i];
+  }
+  *p++ = (uint8_t)(sum >> 8);
+  *p = (uint8_t)(sum & 0xFF);
+#ifdef FINGERPRINT_STATS
+  // before the write, which on SoftwareSerial lasts as long as the frame
+  commandMicros = micros();
+#endif
+  SERIAL_WRITE_BUF(frame, size);
+
+  commandOpcode = frame[FINGERPRINT_HEADERSIZE];
+  commandStart = millis();
+  commandState = FINGERPRINT_BUSY;
+  rxIndex = 0;
+  rxDropped = false;
+  return FINGERPRINT_OK;
+}
+
+void Adafruit_Fingerprint::finishPending(void) {
+  // a begin...() call still in flight: its result goes to poll()'s usual
+  // places, the callback and status(), before the blocking call starts
+  while (poll() == FINGERPRINT_BUSY)
+    delay(1);
+}
+
+uint8_t Adafruit_Fingerprint::waitForResult(uint8_t started) {
+  if (started != FINGERPRINT_OK)
+    return started;
+
+  uint8_t p;
+  while ((p = poll()) == FINGERPRINT_BUSY)
+    delay(1);
+  return p;
+}
+
+uint8_t Adafruit_Fingerprint::receiveReply(void) {
+  uint8_t p = parseAvailable(&reply, reply.data, sizeof(reply.data));
+  if (p == FINGERPRINT_OK)
+    return reply.type == FINGERPRINT_ACKPACKET ? FINGERPRINT_OK : FINGERPRINT_BADPACKET;
+  if (p != FINGERPRINT_BUSY)
+    return p;
+  if (rxDropped && millis() - rxLastByte >= FINGERPRINT_RESYNCIDLE)
+    return FINGERPRINT_BADPACKET;
+  if (millis() - commandStart >= DEFAULTTIMEOUT) {
+    trace(FINGERPRINT_TRACE_TIMEOUT, 0);
+    return FINGERPRINT_TIMEOUT;
+  }
+  return FINGERPRINT_BUSY;
 }
 
 /**************************************************************************/
@@ -264,114 +981,971 @@ uint8_t Adafruit_Fingerprint::getTemplateCount(void) {
 */
 /**************************************************************************/
 uint8_t Adafruit_Fingerprint::setPassword(uint32_t password) {
-  SEND_CMD_PACKET(FINGERPRINT_SETPASSWORD, (password >> 24), (password >> 16), (password >> 8), password);
+  uint8_t params[] = { (uint8_t)(password >> 24), (uint8_t)(password >> 16),
+                       (uint8_t)(password >> 8), (uint8_t)(password & 0xFF) };
+  return runCommand<FINGERPRINT_SETPASSWORD>(params);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Move the module to a new address (SetAdder). It answers only
+             frames carrying that address from then on, also after a power
+             cycle, so several modules can be told apart. The library
+             switches to the new address along with it.
+    @param   address 32-bit module address, FINGERPRINT_DEFAULTADDRESS out of the box
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::setAddress(uint32_t address) {
+  uint8_t params[] = { (uint8_t)(address >> 24), (uint8_t)(address >> 16),
+                       (uint8_t)(address >> 8), (uint8_t)(address & 0xFF) };
+  uint32_t previous = theAddress;
+  finishPending();
+  uint8_t p = startCommand<FINGERPRINT_SETADDRESS>(params);
+  if (p != FINGERPRINT_OK)
+    return p;
+  // the ACK already comes from the new address
+  theAddress = address;
+  p = waitForResult(p);
+  if (p != FINGERPRINT_OK)
+    theAddress = previous;
+  return p;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Talk to the module at <b>address</b> from now on, e.g. one moved
+             there by setAddress() earlier. Replies from other addresses are
+             dropped. Nothing is sent to the module.
+    @param   address 32-bit module address
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint::useAddress(uint32_t address) {
+  theAddress = address;
 }
 
 /**************************************************************************/
 /*!
     @brief   Helper function to process a packet and send it over UART to the sensor
-    @param   packet A structure containing the bytes to transmit
+    @param   header Type and payload length of the packet to transmit
+    @param   data The payload, sent straight from the caller's packet
+    @param   capacity Size of <b>data</b>; longer lengths are cut to it
 */
 /**************************************************************************/
+void Adafruit_Fingerprint::writeFrame(const Adafruit_Fingerprint_PacketHeader & header, const uint8_t *data, uint16_t capacity) {
+  uint8_t frame[FINGERPRINT_HEADERSIZE];
+  uint16_t length = header.length < capacity ? header.length : capacity;
+  uint16_t sum = fillPacketHeader(frame, header.type, length);
+  for (uint16_t i=0; i< length; i++)
+    sum += data[i];
+  uint8_t checksum[2] = { (uint8_t)(sum >> 8), (uint8_t)(sum & 0xFF) };
+
+  SERIAL_WRITE_BUF(frame, sizeof(frame));
+  SERIAL_WRITE_BUF(data, length);
+  SERIAL_WRITE_BUF(checksum, sizeof(checksum));
+}
 
-void Adafruit_Fingerprint::writeStructuredPacket(const Adafruit_Fingerprint_Packet & packet) {
-  SERIAL_WRITE_U16(packet.start_code);
-  SERIAL_WRITE(packet.address[0]);
-  SERIAL_WRITE(packet.address[1]);
-  SERIAL_WRITE(packet.address[2]);
-  SERIAL_WRITE(packet.address[3]);
-  SERIAL_WRITE(packet.type);
+uint16_t Adafruit_Fingerprint::fillPacketHeader(uint8_t *header, uint8_t type, uint16_t length) {
+  uint16_t wire_length = length + 2;
 
-  uint16_t wire_length = packet.length + 2;
-  SERIAL_WRITE_U16(wire_length);
+  header[0] = (uint8_t)(FINGERPRINT_STARTCODE >> 8);
+  header[1] = (uint8_t)(FINGERPRINT_STARTCODE & 0xFF);
+  header[2] = (uint8_t)(theAddress >> 24);
+  header[3] = (uint8_t)(theAddress >> 16);
+  header[4] = (uint8_t)(theAddress >> 8);
+  header[5] = (uint8_t)(theAddress & 0xFF);
+  header[6] = type;
+  header[7] = (uint8_t)(wire_length >> 8);
+  header[8] = (uint8_t)(wire_length & 0xFF);
+
+  return ((wire_length)>>8) + ((wire_length)&0xFF) + type;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Send a template into one of the sensor's char buffers (DOWNLOAD)
+    @param   data Template bytes, <b>length</b> long
+    @param   length Number of bytes to send, usually FINGERPRINT_TEMPLATESIZE
+    @param   slot Char buffer to fill, 1 or 2
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRESPONSEFAIL</code> if the sensor refuses the transfer
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::downloadModel(const uint8_t *data, uint16_t length, uint8_t slot) {
+  return downloadModel(NULL, (void *)data, length, slot);
+}
 
-  uint16_t sum = ((wire_length)>>8) + ((wire_length)&0xFF) + packet.type;
-  for (uint8_t i=0; i< packet.length; i++) {
-    SERIAL_WRITE(packet.data[i]);
-    sum += packet.data[i];
+/**************************************************************************/
+/*!
+    @brief   Send a template into one of the sensor's char buffers (DOWNLOAD),
+             pulling the bytes from a callback as the data packets go out, so
+             the template never has to sit in RAM as a whole. It is split into
+             <b>packetLength</b> sized DATAPACKETs closed by an ENDDATAPACKET.
+    @param   source Called for up to FINGERPRINT_CHUNKSIZE bytes at a time,
+             or NULL to read <b>context</b> as a plain byte pointer
+    @param   context Passed through to <b>source</b>
+    @param   length Number of bytes to send, usually FINGERPRINT_TEMPLATESIZE
+    @param   slot Char buffer to fill, 1 or 2
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRESPONSEFAIL</code> if the sensor refuses the transfer or the source runs dry
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::downloadModel(Adafruit_Fingerprint_Source source, void *context, uint16_t length, uint8_t slot) {
+  uint8_t params[] = { slot };
+  uint8_t p = runCommand<FINGERPRINT_DOWNLOAD>(params);
+  if (p != FINGERPRINT_OK)
+    return p;
+
+  return writeDataPackets(source, context, length);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Download a template into char buffer 1 and store it in flash
+    @param   id The model location #
+    @param   data Template bytes, <b>length</b> long
+    @param   length Number of bytes to send, usually FINGERPRINT_TEMPLATESIZE
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_BADLOCATION</code> if the location is invalid
+    @returns <code>FINGERPRINT_FLASHERR</code> if the model couldn't be written to flash memory
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::storeTemplate(uint16_t id, const uint8_t *data, uint16_t length) {
+  return storeTemplate(id, NULL, (void *)data, length);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Download a template from a byte source into char buffer 1 and store it in flash
+    @param   id The model location #
+    @param   source Template byte producer, see downloadModel()
+    @param   context Passed through to <b>source</b>
+    @param   length Number of bytes to send, usually FINGERPRINT_TEMPLATESIZE
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_BADLOCATION</code> if the location is invalid
+    @returns <code>FINGERPRINT_FLASHERR</code> if the model couldn't be written to flash memory
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::storeTemplate(uint16_t id, Adafruit_Fingerprint_Source source, void *context, uint16_t length) {
+  uint8_t p = downloadModel(source, context, length, 1);
+  if (p != FINGERPRINT_OK)
+    return p;
+  return storeModel(id);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Store a template that lives in flash. The bytes are read with
+             pgm_read_byte() a slice at a time straight into the outgoing
+             data packets, so the template never occupies SRAM.
+    @param   id The model location #
+    @param   data PROGMEM address of the template bytes
+    @param   length Number of bytes to send, usually FINGERPRINT_TEMPLATESIZE
+    @returns See storeTemplate(uint16_t, const uint8_t *, uint16_t)
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::storeTemplate_P(uint16_t id, const uint8_t *data, uint16_t length) {
+  const uint8_t *cursor = data;
+  return storeTemplate(id, progmemSource, &cursor, length);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Store one entry of a PROGMEM template bank
+    @param   entry PROGMEM address of the entry
+    @returns See storeTemplate(uint16_t, const uint8_t *, uint16_t)
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::storeTemplate_P(const Adafruit_Fingerprint_Template *entry) {
+  Adafruit_Fingerprint_Template t;
+  memcpy_P(&t, entry, sizeof(t));
+  if (t.encoding == FINGERPRINT_TEMPLATE_RLE)
+    return storeTemplateRLE_P(t.id, t.data, t.length);
+  return storeTemplate_P(t.id, t.data, t.length);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Store a run-length coded template that lives in flash, as written
+             by tools/template_bank_gen.py. It is decoded on the fly into the
+             outgoing data packets. Each control byte below 0x80 is followed by
+             that many plus one literal bytes; from 0x80 up, the one byte after
+             it repeats (control & 0x7F) + 3 times.
+    @param   id The model location #
+    @param   data PROGMEM address of the coded template
+    @param   length Size of the template once decoded, usually FINGERPRINT_TEMPLATESIZE
+    @returns See storeTemplate(uint16_t, const uint8_t *, uint16_t)
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::storeTemplateRLE_P(uint16_t id, const uint8_t *data, uint16_t length) {
+  RleCursor cursor = { data, 0, 0, false };
+  return storeTemplate(id, rleSource, &cursor, length);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Store every template of a PROGMEM bank at its page, in order
+    @param   bank PROGMEM array of entries
+    @param   count Number of entries in <b>bank</b>
+    @returns <code>FINGERPRINT_OK</code> once all are stored
+    @returns Otherwise the code of the first entry that failed; the ones before it are stored, the rest are not tried
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::storeTemplateBank(const Adafruit_Fingerprint_Template *bank, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t p = storeTemplate_P(&bank[i]);
+    if (p != FINGERPRINT_OK)
+      return p;
   }
+  return FINGERPRINT_OK;
+}
 
-  SERIAL_WRITE_U16(sum);
-  return;
+uint16_t Adafruit_Fingerprint::rleSource(uint8_t *buffer, uint16_t len, void *context) {
+  RleCursor *cursor = (RleCursor *)context;
+  for (uint16_t i = 0; i < len; i++) {
+    if (!cursor->count) {
+      uint8_t control = pgm_read_byte(cursor->next++);
+      cursor->run = control & 0x80;
+      if (cursor->run) {
+        cursor->count = (control & 0x7F) + 3;
+        cursor->value = pgm_read_byte(cursor->next++);
+      } else {
+        cursor->count = control + 1;
+      }
+    }
+    buffer[i] = cursor->run ? cursor->value : pgm_read_byte(cursor->next++);
+    cursor->count--;
+  }
+  return len;
 }
 
-uint8_t Adafruit_Fingerprint::uploadModel(void) {
-uint8_t datapacket[] = {
-  //fingerprint goes here 
-};
-  sendCommandDownload();
-  sendDatapacketDownload(datapacket);
+uint16_t Adafruit_Fingerprint::progmemSource(uint8_t *buffer, uint16_t len, void *context) {
+  const uint8_t **cursor = (const uint8_t **)context;
+  for (uint16_t i = 0; i < len; i++)
+    buffer[i] = pgm_read_byte((*cursor)++);
+  return len;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Read a template out of one of the sensor's char buffers (UPLOAD).
+             Data packets are parsed as they arrive and their payload handed
+             to <b>sink</b> in pieces of up to FINGERPRINT_CHUNKSIZE bytes;
+             the frames themselves are never buffered. The byte count ends up
+             in <b>transferLength</b>.
+    @param   sink Receives the template bytes in order
+    @param   context Passed through to <b>sink</b>
+    @param   slot Char buffer to read, 1 or 2
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_UPLOADFEATUREFAIL</code> if the buffer holds no template
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+    @returns <code>FINGERPRINT_TIMEOUT</code> or <code>FINGERPRINT_BADPACKET</code> if the data packets break off or fail their checksum
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::uploadModel(Adafruit_Fingerprint_Sink sink, void *context, uint8_t slot) {
+  transferLength = 0;
+  uint8_t params[] = { slot };
+  uint8_t p = runCommand<FINGERPRINT_UPLOAD>(params);
+  if (p != FINGERPRINT_OK)
+    return p;
+
+  return countFailure(readDataPackets(sink, context, NULL, 0));
 }
 
-void Adafruit_Fingerprint::sendCommandDownload(void) {
-  SEND_CMD_PACKET(FINGERPRINT_DOWNLOAD, 0x02);
+/**************************************************************************/
+/*!
+    @brief   Read a template out of one of the sensor's char buffers (UPLOAD)
+             straight into a caller buffer. Bytes beyond <b>size</b> are
+             drained from the UART and dropped.
+    @param   buffer Destination, usually FINGERPRINT_TEMPLATESIZE bytes
+    @param   size Capacity of <b>buffer</b>
+    @param   slot Char buffer to read, 1 or 2
+    @returns See uploadModel(Adafruit_Fingerprint_Sink, void *, uint8_t)
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::uploadModel(uint8_t *buffer, uint16_t size, uint8_t slot) {
+  transferLength = 0;
+  uint8_t params[] = { slot };
+  uint8_t p = runCommand<FINGERPRINT_UPLOAD>(params);
+  if (p != FINGERPRINT_OK)
+    return p;
+
+  return countFailure(readDataPackets(NULL, NULL, buffer, size));
 }
 
-void Adafruit_Fingerprint::sendDatapacketDownload(uint8_t simplepacket[]) {
-  SEND_CMD_PACKET(FINGERPRINT_DATAPACKET, sizeof(simplepacket), simplepacket);
+/**************************************************************************/
+/*!
+    @brief   Read the last captured image out of the sensor (UPIMAGE), streaming
+             the pixel data to <b>sink</b> as it arrives
+    @param   sink Receives the image bytes in order
+    @param   context Passed through to <b>sink</b>
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_UPLOADFAIL</code> if the sensor has no image to send
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+    @returns <code>FINGERPRINT_TIMEOUT</code> or <code>FINGERPRINT_BADPACKET</code> if the data packets break off or fail their checksum
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::uploadImage(Adafruit_Fingerprint_Sink sink, void *context) {
+  transferLength = 0;
+  uint8_t p = runCommand<FINGERPRINT_UPIMAGE>();
+  if (p != FINGERPRINT_OK)
+    return p;
+
+  return countFailure(readDataPackets(sink, context, NULL, 0));
+}
+
+/**************************************************************************/
+/*!
+    @brief   Back up every occupied page of the template library to
+             <b>out</b>, typically the host serial port. Each template is
+             LOADed and UPLOADed with its data packets forwarded as they
+             arrive, and the LOAD of the next page is already running on the
+             sensor while a record is being finished, so the host link and
+             the sensor stay busy at the same time. Used pages are taken from
+             the index table; modules without ReadIndexTable get every page
+             probed, and pages that cannot be loaded are skipped, as are
+             pages set aside with reservePages().
+
+             The stream is binary. Each record is FINGERPRINT_BACKUPMAGIC, the
+             page number (2 bytes, MSB first), the template in blocks of a
+             length byte (1-255) and that many bytes, a 0 length byte, and the
+             16-bit sum of the page number and template bytes. A record whose
+             upload broke off carries an inverted sum. The stream closes with
+             a record for page FINGERPRINT_BACKUPEND with no template bytes.
+             tools/backup_receive.py turns it back into one file per page.
+
+             Data packets are written to <b>out</b> while the sensor keeps
+             sending, so <b>out</b> must keep up with the sensor link: a host
+             port slower than it (e.g. Serial at 9600 against a sensor at
+             57600) blocks on a full transmit buffer while the sensor's
+             receive buffer overflows, and the export fails partway.
+    @param   out Destination of the backup stream
+    @param   first First page to look at
+    @param   count Number of pages to look at; 0 means up to the end of the
+             library, taking its size from getParameters() if not known yet
+    @returns <code>FINGERPRINT_OK</code> once the stream is closed;
+             <b>templateCount</b> holds the number of templates written
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error, leaving the stream unclosed
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::exportLibrary(Print &out, uint16_t first, uint16_t count) {
+  finishPending();
+  if (!count) {
+    if (!capacity && getParameters() != FINGERPRINT_OK)
+      return FINGERPRINT_PACKETRECIEVEERR;
+    count = capacity > first ? capacity - first : 0;
+  }
+
+  ExportRecord record;
+  record.out = &out;
+  templateCount = 0;
+
+  uint8_t bitmap[FINGERPRINT_INDEXTABLESIZE];
+  uint8_t table = 0xFF;
+  uint16_t end = first + count;
+  uint16_t page = nextStored(first, end, bitmap, &table);
+  uint8_t loading = page < end ? beginLoadModel(page) : FINGERPRINT_OK;
+  while (page < end) {
+    uint8_t p = waitForResult(loading);
+    if (p == FINGERPRINT_PACKETRECIEVEERR || p == FINGERPRINT_BUSY)
+      return FINGERPRINT_PACKETRECIEVEERR;
+    if (p != FINGERPRINT_OK) {
+      // nothing stored there after all
+      page = nextStored(page + 1, end, bitmap, &table);
+      if (page < end)
+        loading = beginLoadModel(page);
+      continue;
+    }
+
+    uint8_t header[] = { FINGERPRINT_BACKUPMAGIC, (uint8_t)(page >> 8), (uint8_t)(page & 0xFF) };
+    out.write(header, sizeof(header));
+    record.sum = header[1] + header[2];
+    p = uploadModel(exportSink, &record, 1);
+
+    // the sensor loads the next page while the trailer goes out
+    page = nextStored(page + 1, end, bitmap, &table);
+    if (page < end)
+      loading = beginLoadModel(page);
+    if (p != FINGERPRINT_OK)
+      record.sum = ~record.sum;
+    uint8_t trailer[] = { 0, (uint8_t)(record.sum >> 8), (uint8_t)(record.sum & 0xFF) };
+    out.write(trailer, sizeof(trailer));
+    if (p == FINGERPRINT_OK)
+      templateCount++;
+  }
+
+  uint16_t last = FINGERPRINT_BACKUPEND;
+  uint16_t sum = (last >> 8) + (last & 0xFF);
+  uint8_t close[] = { FINGERPRINT_BACKUPMAGIC, (uint8_t)(last >> 8), (uint8_t)(last & 0xFF),
+                      0, (uint8_t)(sum >> 8), (uint8_t)(sum & 0xFF) };
+  out.write(close, sizeof(close));
+  return FINGERPRINT_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Set pages aside for the library's own use, e.g. the copies an
+             Adafruit_Fingerprint_HotSet keeps. exportLibrary() skips them,
+             and when <b>copyOf</b> is given a search or identify() that
+             matches a copy reports the page it copies as <b>fingerID</b>,
+             and getTemplateCount() leaves the copies out of
+             <b>templateCount</b>. Nothing may be enrolled there.
+    @param   first First reserved page
+    @param   count Number of reserved pages, 0 to reserve none
+    @param   copyOf <b>count</b> entries, kept by the caller: the own page of
+             the template copied to each reserved page, FINGERPRINT_NOPAGE
+             where there is none; or NULL
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint::reservePages(uint16_t first, uint16_t count, const uint16_t *copyOf) {
+  reservedFirst = first;
+  reservedCount = count;
+  reservedCopyOf = copyOf;
+}
+
+uint16_t Adafruit_Fingerprint::nextStored(uint16_t page, uint16_t end, uint8_t *bitmap, uint8_t *table) {
+  while (page < end) {
+    if ((uint16_t)(page - reservedFirst) < reservedCount) {
+      page = reservedFirst + reservedCount;
+      continue;
+    }
+    uint8_t t = page / (FINGERPRINT_INDEXTABLESIZE * 8);
+    if (t != *table) {
+      // without an index table every page has to be probed
+      if (readIndexTable(t, bitmap) != FINGERPRINT_OK)
+        memset(bitmap, 0xFF, FINGERPRINT_INDEXTABLESIZE);
+      *table = t;
+    }
+    uint8_t bit = page % (FINGERPRINT_INDEXTABLESIZE * 8);
+    if (!bitmap[bit >> 3])
+      page = (page | 7) + 1;
+    else if (bitmap[bit >> 3] & (1 << (bit & 7)))
+      return page;
+    else
+      page++;
+  }
+  return end;
+}
+
+uint16_t Adafruit_Fingerprint::homePage(uint16_t page) const {
+  uint16_t i = page - reservedFirst;
+  if (reservedCopyOf && i < reservedCount && reservedCopyOf[i] != FINGERPRINT_NOPAGE)
+    return reservedCopyOf[i];
+  return page;
+}
+
+void Adafruit_Fingerprint::exportSink(const uint8_t *data, uint16_t len, void *context) {
+  ExportRecord *record = (ExportRecord *)context;
+  for (uint16_t i = 0; i < len; i++)
+    record->sum += data[i];
+  // sink pieces are at most FINGERPRINT_CHUNKSIZE, well under a length byte
+  uint8_t n = (uint8_t)len;
+  record->out->write(&n, 1);
+  record->out->write(data, len);
+}
+
+uint8_t Adafruit_Fingerprint::readDataPackets(Adafruit_Fingerprint_Sink sink, void *context, uint8_t *buffer, uint16_t size) {
+  uint8_t chunk[FINGERPRINT_CHUNKSIZE];
+  uint8_t byte, type, fill = 0, result = FINGERPRINT_OK;
+
+  do {
+    // start code, then skip the address
+    uint8_t idx = 0;
+    while (idx < 6) {
+      if (readByte(&byte, DEFAULTTIMEOUT) != FINGERPRINT_OK)
+        return FINGERPRINT_TIMEOUT;
+      if (idx == 0 && byte != (FINGERPRINT_STARTCODE >> 8))
+        continue;
+      if (idx == 1 && byte != (FINGERPRINT_STARTCODE & 0xFF)) {
+        idx = (byte == (FINGERPRINT_STARTCODE >> 8)) ? 1 : 0;
+        continue;
+      }
+      idx++;
+    }
+
+    uint8_t lengthHigh, lengthLow;
+    if (readByte(&type, DEFAULTTIMEOUT) != FINGERPRINT_OK ||
+        readByte(&lengthHigh, DEFAULTTIMEOUT) != FINGERPRINT_OK ||
+        readByte(&lengthLow, DEFAULTTIMEOUT) != FINGERPRINT_OK)
+      return FINGERPRINT_TIMEOUT;
+    if (type != FINGERPRINT_DATAPACKET && type != FINGERPRINT_ENDDATAPACKET)
+      return FINGERPRINT_BADPACKET;
+
+    uint16_t wire_length = ((uint16_t)lengthHigh << 8) | lengthLow;
+    if (wire_length < 2)
+      return FINGERPRINT_BADPACKET;
+    uint16_t sum = lengthHigh + lengthLow + type;
+
+    // payload in runs: as much as fits where it's going, read in one call
+    for (uint16_t left = wire_length - 2; left; ) {
+      uint8_t *run = chunk;
+      uint16_t n = sizeof(chunk);
+      if (sink) {
+        run = chunk + fill;
+        n = sizeof(chunk) - fill;
+      } else if (transferLength < size) {
+        run = buffer + transferLength;
+        n = size - transferLength;
+      }
+      if (n > left)
+        n = left;
+      if (receiveBytes(run, n, DEFAULTTIMEOUT) != FINGERPRINT_OK)
+        return FINGERPRINT_TIMEOUT;
+      for (uint16_t i = 0; i < n; i++)
+        sum += run[i];
+      left -= n;
+      transferLength += n;
+      if (sink) {
+        fill += n;
+        if (fill == sizeof(chunk)) {
+          sink(chunk, fill, context);
+          fill = 0;
+        }
+      }
+    }
+
+    if (readByte(&lengthHigh, DEFAULTTIMEOUT) != FINGERPRINT_OK ||
+        readByte(&lengthLow, DEFAULTTIMEOUT) != FINGERPRINT_OK)
+      return FINGERPRINT_TIMEOUT;
+    boolean good = (((uint16_t)lengthHigh << 8) | lengthLow) == sum;
+    trace(FINGERPRINT_TRACE_FRAME, good ? FINGERPRINT_OK : FINGERPRINT_BADPACKET);
+    if (!good)
+      result = FINGERPRINT_BADPACKET;   // keep draining so the next command starts clean
+  } while (type != FINGERPRINT_ENDDATAPACKET);
+
+  if (sink && fill)
+    sink(chunk, fill, context);
+  return result;
+}
+
+uint8_t Adafruit_Fingerprint::parseAvailable(Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity) {
+  return parseFrom(mySerial, header, data, capacity);
+}
+
+uint8_t Adafruit_Fingerprint::receiveBytes(uint8_t *buffer, uint16_t size, uint16_t timeout) {
+  return receiveFrom(mySerial, buffer, size, timeout);
+}
+
+uint8_t Adafruit_Fingerprint::writeDataPackets(Adafruit_Fingerprint_Source source, void *context, uint16_t length) {
+  const uint8_t *data = (const uint8_t *)context;
+  uint8_t chunk[FINGERPRINT_CHUNKSIZE];
+  boolean starved = false;
+
+  do {
+    uint16_t payload = length < packetLength ? length : packetLength;
+    length -= payload;
+
+    uint8_t header[FINGERPRINT_HEADERSIZE];
+    uint16_t sum = fillPacketHeader(header, length ? FINGERPRINT_DATAPACKET : FINGERPRINT_ENDDATAPACKET, payload);
+    SERIAL_WRITE_BUF(header, sizeof(header));
+    while (payload) {
+      // buffers go out as one slice per packet, sources in chunk-sized slices
+      uint16_t n = (source && payload > sizeof(chunk)) ? sizeof(chunk) : payload;
+      const uint8_t *bytes = data;
+      if (source) {
+        uint16_t got = starved ? 0 : source(chunk, n, context);
+        if (got < n) {
+          // keep the framing intact so the sensor is not left waiting
+          memset(chunk + got, 0xFF, n - got);
+          starved = true;
+        }
+        bytes = chunk;
+      } else {
+        data += n;
+      }
+      SERIAL_WRITE_BUF(bytes, n);
+      for (uint16_t i=0; i<n; i++)
+        sum += bytes[i];
+      payload -= n;
+    }
+    uint8_t checksum[2] = { (uint8_t)(sum >> 8), (uint8_t)(sum & 0xFF) };
+    SERIAL_WRITE_BUF(checksum, sizeof(checksum));
+  } while (length);
+
+  return starved ? FINGERPRINT_PACKETRESPONSEFAIL : FINGERPRINT_OK;
 }
 /**************************************************************************/
 /*!
     @brief   Helper function to receive data over UART from the sensor and process it into a packet
-    @param   packet A structure containing the bytes received
+    @param   header The received packet's type and payload length
+    @param   data Where the payload goes
+    @param   capacity Size of <b>data</b>; payload beyond it is checked but dropped
     @param   timeout how many milliseconds we're willing to wait
     @returns <code>FINGERPRINT_OK</code> on success
     @returns <code>FINGERPRINT_TIMEOUT</code> or <code>FINGERPRINT_BADPACKET</code> on failure
 */
 /**************************************************************************/
-uint8_t Adafruit_Fingerprint::getStructuredPacket(Adafruit_Fingerprint_Packet * packet, uint16_t timeout) {
-  uint8_t byte;
-  uint16_t idx=0, timer=0;
+uint8_t Adafruit_Fingerprint::readFrame(Adafruit_Fingerprint_PacketHeader * header, uint8_t *data, uint16_t capacity, uint16_t timeout) {
+  uint16_t timer=0;
 
+  rxIndex = 0;
+  rxDropped = false;
   while(true) {
-    while(!mySerial->available()) {
-      delay(1);
-      timer++; 
-      if( timer >= timeout) {
-#ifdef FINGERPRINT_DEBUG
-	Serial.println("Timed out");
-#endif
-	return FINGERPRINT_TIMEOUT;
-      }
+    uint8_t p = parseAvailable(header, data, capacity);
+    if (p != FINGERPRINT_BUSY)
+      return countFailure(p);
+    if (rxDropped && millis() - rxLastByte >= FINGERPRINT_RESYNCIDLE)
+      return countFailure(FINGERPRINT_BADPACKET);
+    if( timer >= timeout) {
+      trace(FINGERPRINT_TRACE_TIMEOUT, 0);
+      return countFailure(FINGERPRINT_TIMEOUT);
     }
-    byte = mySerial->read();
-#ifdef FINGERPRINT_DEBUG
-    Serial.print("<- 0x"); Serial.println(byte, HEX);
-#endif
-    switch (idx) {
+    delay(1);
+    timer++;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief   Feed one received byte to the packet parser. Bytes ahead of a
+             start code are skipped, a frame whose header does not make
+             sense is dropped and the hunt for the next 0xEF01 resumes just
+             after its start code, and
+             the checksum is summed as the bytes go by.
+    @param   packet Where the frame is assembled; <b>length</b> ends up as the payload size
+    @param   data Where the payload goes
+    @param   capacity Size of <b>data</b>
+    @param   byte The byte just read from the UART
+    @returns <code>FINGERPRINT_BUSY</code> until a whole frame is in
+    @returns <code>FINGERPRINT_OK</code> on a frame with a good checksum
+    @returns <code>FINGERPRINT_BADPACKET</code> on a checksum mismatch, with the whole frame
+             consumed unless a start code inside it begins another
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::parseByte(Adafruit_Fingerprint_PacketHeader * packet, uint8_t *data, uint16_t capacity, uint8_t byte) {
+    uint16_t limit = packetLength;
+
+    switch (rxIndex) {
       case 0:
         if (byte != (FINGERPRINT_STARTCODE >> 8)) 
-	  continue;
-        packet->start_code = (uint16_t)byte << 8;
+	  return FINGERPRINT_BUSY;
         break;
       case 1:
-        packet->start_code |= byte;
-        if (packet->start_code != FINGERPRINT_STARTCODE) 
-	  return FINGERPRINT_BADPACKET;
+        if (byte != (FINGERPRINT_STARTCODE & 0xFF)) {
+          rxIndex = (byte == (FINGERPRINT_STARTCODE >> 8)) ? 1 : 0;
+	  return FINGERPRINT_BUSY;
+        }
+        packet->start_code = FINGERPRINT_STARTCODE;
         break;
       case 2:
       case 3:
       case 4:
       case 5:
-        packet->address[idx-2] = byte;
+        packet->address[rxIndex-2] = byte;
+        if (byte != (uint8_t)(theAddress >> (8 * (5 - rxIndex)))) {
+          // another module's frame, or a corrupt one
+          return dropFrame(packet, data, capacity, byte);
+        }
         break;
       case 6: 
 	packet->type = byte; 
+	rxSum = byte;
+	if (byte != FINGERPRINT_ACKPACKET && byte != FINGERPRINT_DATAPACKET &&
+	    byte != FINGERPRINT_ENDDATAPACKET && byte != FINGERPRINT_COMMANDPACKET) {
+	  return dropFrame(packet, data, capacity, byte);
+	}
 	break;
       case 7: 
 	packet->length = (uint16_t)byte << 8; 
+	rxSum += byte;
 	break;
       case 8: 
 	packet->length |= byte; 
+	rxSum += byte;
+	// data packets are cut to the configured size; other packets,
+	// e.g. ReadIndexTable's ACK, may well be longer
+	if (packet->type != FINGERPRINT_DATAPACKET && packet->type != FINGERPRINT_ENDDATAPACKET)
+	  limit = capacity > FINGERPRINT_REPLYSIZE ? capacity : FINGERPRINT_REPLYSIZE;
+	if (packet->length < 2 || packet->length > limit + 2) {
+	  return dropFrame(packet, data, capacity, byte);
+	}
+	packet->length -= 2;
 	break;
-      default:
-        packet->data[idx-9] = byte;
-        if((idx-8) == packet->length)
-          return FINGERPRINT_OK;
+      default: {
+        uint16_t i = rxIndex-9;
+        if (i < packet->length) {
+          if (i < capacity)
+            data[i] = byte;
+          rxSum += byte;
+        } else if (i == packet->length) {
+          rxSum -= (uint16_t)byte << 8;
+        } else {
+          // rxSum is zero once the received checksum is taken off again
+          if (!(uint16_t)(rxSum - byte)) {
+            rxIndex = 0;
+            trace(FINGERPRINT_TRACE_FRAME, FINGERPRINT_OK);
+            return FINGERPRINT_OK;
+          }
+          trace(FINGERPRINT_TRACE_FRAME, FINGERPRINT_BADPACKET);
+          // a false start code may have swallowed the real one
+          if (packet->length <= capacity) {
+            uint8_t p = rescan(packet, data, capacity, byte);
+            if (p != FINGERPRINT_BUSY)
+              return p;
+            if (rxIndex) {
+              rxDropped = true;
+              return FINGERPRINT_BUSY;
+            }
+          }
+          rxIndex = 0;
+          return FINGERPRINT_BADPACKET;
+        }
         break;
+      }
+    }
+    rxIndex++;
+    return FINGERPRINT_BUSY;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Give up on a frame whose header does not make sense, and hunt
+             for the start code again from just after its own
+    @param   packet Where the frame is assembled
+    @param   data Where the payload goes
+    @param   capacity Size of <b>data</b>
+    @param   byte The byte that gave the frame away
+    @returns What rescan() returns
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::dropFrame(Adafruit_Fingerprint_PacketHeader *packet, uint8_t *data, uint16_t capacity, uint8_t byte) {
+  rxDropped = true;
+  trace(FINGERPRINT_TRACE_DROP, byte);
+#ifdef FINGERPRINT_STATS
+  if (stats.resyncs != 0xFFFF)
+    stats.resyncs++;
+#endif
+  return rescan(packet, data, capacity, byte);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Feed parseByte() again with the bytes a false frame took after
+             its start code, <b>byte</b> last, since the real frame may
+             start among them. They are rebuilt from the header fields, the
+             payload in <b>data</b> and the running checksum.
+    @param   packet Where the false frame was assembled
+    @param   data Its payload, which must all be held there
+    @param   capacity Size of <b>data</b>
+    @param   byte The byte that gave the frame away
+    @returns <code>FINGERPRINT_BUSY</code>, with rxIndex set if a frame is
+             under way, or the result of a frame that ends among the bytes
+*/
+/**************************************************************************/
+uint8_t Adafruit_Fingerprint::rescan(Adafruit_Fingerprint_PacketHeader *packet, uint8_t *data, uint16_t capacity, uint8_t byte) {
+  uint16_t taken = rxIndex;
+  uint16_t payload = taken > 9 ? packet->length : 0;
+  uint16_t wire = taken > 8 ? packet->length + 2 : packet->length;
+  uint8_t header[] = { packet->address[0], packet->address[1], packet->address[2], packet->address[3],
+                       packet->type, (uint8_t)(wire >> 8), (uint8_t)(wire & 0xFF) };
+  uint8_t checksumHigh = 0;
+  if (taken > 9) {
+    // rxSum is the sum of the frame less the checksum's high byte
+    uint16_t sum = header[4] + header[5] + header[6];
+    for (uint16_t i = 0; i < payload; i++)
+      sum += data[i];
+    checksumHigh = (uint16_t)(sum - rxSum) >> 8;
+  }
+
+  // a frame found here writes its payload behind the bytes still to be fed
+  rxIndex = 0;
+  for (uint16_t k = 2; k <= taken; k++) {
+    uint8_t b = k == taken ? byte : k < 9 ? header[k - 2] : k - 9 < payload ? data[k - 9] : checksumHigh;
+    uint8_t p = parseByte(packet, data, capacity, b);
+    if (p != FINGERPRINT_BUSY)
+      return p;
+  }
+  return FINGERPRINT_BUSY;
+}
+
+
+/***************************************************************************
+ TRANSCRIPTS
+ ***************************************************************************/
+
+/**************************************************************************/
+/*!
+    @brief  Instantiates a recorder in front of the sensor's port
+    @param  line The Stream the sensor is connected to
+    @param  log Where the recorded blocks are written, e.g. a File
+*/
+/**************************************************************************/
+Adafruit_Fingerprint_Recorder::Adafruit_Fingerprint_Recorder(Stream *line, Print *log) {
+  this->line = line;
+  this->log = log;
+  count = 0;
+}
+
+int Adafruit_Fingerprint_Recorder::available(void) {
+  return line->available();
+}
+
+int Adafruit_Fingerprint_Recorder::read(void) {
+  int c = line->read();
+  if (c >= 0)
+    record(FINGERPRINT_TRACE_RX, (uint8_t)c);
+  return c;
+}
+
+int Adafruit_Fingerprint_Recorder::peek(void) {
+  return line->peek();
+}
+
+size_t Adafruit_Fingerprint_Recorder::write(uint8_t c) {
+  record(FINGERPRINT_TRACE_TX, c);
+  return line->write(c);
+}
+
+size_t Adafruit_Fingerprint_Recorder::write(const uint8_t *buffer, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    record(FINGERPRINT_TRACE_TX, buffer[i]);
+  return line->write(buffer, size);
+}
+
+void Adafruit_Fingerprint_Recorder::flush(void) {
+  line->flush();
+}
+
+/**************************************************************************/
+/*!
+    @brief   Write the buffered entries to the log as one block. Blocks are
+             written by themselves whenever the buffer fills, so call this at
+             the end of a capture, when the sensor is idle.
+    @returns The number of entries written
+*/
+/**************************************************************************/
+uint16_t Adafruit_Fingerprint_Recorder::flushLog(void) {
+  uint16_t n = count;
+  if (n) {
+    writeTraceHeader(*log, n, 0);
+    for (uint16_t i = 0; i < n; i++)
+      writeTraceEntry(*log, entries[i]);
+  }
+  count = 0;
+  return n;
+}
+
+void Adafruit_Fingerprint_Recorder::record(uint8_t kind, uint8_t value) {
+  uint32_t now = micros();
+  if (count == FINGERPRINT_RECORDERSIZE)
+    flushLog();
+  Adafruit_Fingerprint_TraceEntry &e = entries[count++];
+  e.time = now;
+  e.kind = kind;
+  e.value = value;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Instantiates a replay of a recorded transcript
+    @param  transcript The recorded blocks, kept in RAM for as long as the replay runs
+    @param  length Bytes in the transcript
+    @param  speed 1 to answer with the recorded timing, N to answer N times
+            faster, 0 to answer as soon as the library has sent its part
+*/
+/**************************************************************************/
+Adafruit_Fingerprint_Replay::Adafruit_Fingerprint_Replay(const uint8_t *transcript, size_t length, uint8_t speed) {
+  this->transcript = transcript;
+  this->length = length;
+  this->speed = speed;
+  rewind();
+}
+
+/**************************************************************************/
+/*!
+    @brief  Start again from the beginning of the transcript
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint_Replay::rewind(void) {
+  sent.offset = received.offset = 0;
+  sent.left = received.left = 0;
+  sent.index = received.index = 0;
+  advance(sent, FINGERPRINT_TRACE_TX);
+  advance(received, FINGERPRINT_TRACE_RX);
+  anchored = false;
+  mismatched = 0;
+}
+
+int Adafruit_Fingerprint_Replay::available(void) {
+  return due() ? 1 : 0;
+}
+
+int Adafruit_Fingerprint_Replay::read(void) {
+  if (!due())
+    return -1;
+  uint8_t value = received.entry.value;
+  advance(received, FINGERPRINT_TRACE_RX);
+  return value;
+}
+
+int Adafruit_Fingerprint_Replay::peek(void) {
+  return due() ? received.entry.value : -1;
+}
+
+size_t Adafruit_Fingerprint_Replay::write(uint8_t c) {
+  if (!sent.valid) {
+    mismatched++;
+    return 1;
+  }
+  if (sent.entry.value != c)
+    mismatched++;
+  // replies are timed from the last byte the library sent, not from the start
+  anchorTime = sent.entry.time;
+  anchorMicros = micros();
+  anchored = true;
+  advance(sent, FINGERPRINT_TRACE_TX);
+  return 1;
+}
+
+void Adafruit_Fingerprint_Replay::advance(Cursor &cursor, uint8_t kind) {
+  cursor.valid = false;
+  for (;;) {
+    if (!cursor.left) {
+      // skip to the next block, like tools/trace_decode.py
+      while (cursor.offset < length && transcript[cursor.offset] != FINGERPRINT_TRACEMAGIC)
+        cursor.offset++;
+      if (cursor.offset + 5 > length)
+        return;
+      cursor.left = ((uint16_t)transcript[cursor.offset + 1] << 8) | transcript[cursor.offset + 2];
+      cursor.offset += 5;
+      continue;
+    }
+    if (cursor.offset + 6 > length)
+      return;
+    const uint8_t *e = transcript + cursor.offset;
+    cursor.offset += 6;
+    cursor.left--;
+    cursor.index++;
+    if (e[4] == kind) {
+      cursor.entry.time = ((uint32_t)e[0] << 24) | ((uint32_t)e[1] << 16) | ((uint32_t)e[2] << 8) | e[3];
+      cursor.entry.kind = e[4];
+      cursor.entry.value = e[5];
+      cursor.valid = true;
+      return;
     }
-    idx++;
   }
-  // Shouldn't get here so...
-  return FINGERPRINT_BADPACKET;
+}
+
+bool Adafruit_Fingerprint_Replay::due(void) {
+  if (!received.valid)
+    return false;
+  // the recorded host had not sent everything ahead of it yet
+  if (sent.valid && sent.index < received.index)
+    return false;
+  if (!speed)
+    return true;
+  if (!anchored) {
+    anchorTime = received.entry.time;
+    anchorMicros = micros();
+    anchored = true;
+  }
+  uint32_t wait = received.entry.time - anchorTime;
+  if (wait & 0x80000000UL)
+    return true;            // recorded before the last byte sent, i.e. already waiting
+  return (uint32_t)(micros() - anchorMicros) >= wait / speed;
 }
@@ -57,6 +57,7 @@
 
 #define FINGERPRINT_TIMEOUT 0xFF
 #define FINGERPRINT_BADPACKET 0xFE
+#define FINGERPRINT_BUSY 0xFD  ///< Returned by poll() while a command is still in flight
 
 #define FINGERPRINT_GETIMAGE 0x01
 #define FINGERPRINT_IMAGE2TZ 0x02
@@ -68,19 +69,155 @@
 #define FINGERPRINT_EMPTY 0x0D
 #define FINGERPRINT_SETPASSWORD 0x12
 #define FINGERPRINT_VERIFYPASSWORD 0x13
+#define FINGERPRINT_SETADDRESS 0x15  ///< SetAdder: move the module to a new 32-bit address
 #define FINGERPRINT_HISPEEDSEARCH 0x1B
 #define FINGERPRINT_TEMPLATECOUNT 0x1D
+#define FINGERPRINT_READINDEX 0x1F
 //-----------------------------------------
 #define FINGERPRINT_DOWNLOAD 0x09 //added the DOWNLOAD template function
 #define FINGERPRINT_MATCH 0x03
+#define FINGERPRINT_IDENTIFY 0x11  ///< GetImage + Img2Tz + search of the whole library in one command
+#define FINGERPRINT_UPIMAGE 0x0A
+#define FINGERPRINT_SETSYSPARA 0x0E
+#define FINGERPRINT_READSYSPARA 0x0F
 //-----------------------------------------
 
-//#define FINGERPRINT_DEBUG
+//#define FINGERPRINT_STATS  // keep latency histograms and error counts, see printStats()
+//#define FINGERPRINT_TRACE  // record UART traffic in RAM, see drainTrace()
 
 #define DEFAULTTIMEOUT 1000  ///< UART reading timeout in milliseconds
 
-///! Helper class to craft UART packets
-struct Adafruit_Fingerprint_Packet {
+#define FINGERPRINT_BAUD_REG_ADDR 0x4  ///< SetSysPara register: UART rate is N x 9600
+#define FINGERPRINT_SECURITY_REG_ADDR 0x5  ///< SetSysPara register: match security level 1-5
+#define FINGERPRINT_PACKET_REG_ADDR 0x6  ///< SetSysPara register: data packet size code
+#define FINGERPRINT_BAUDRATE_STEP 9600  ///< Unit of the baud rate register
+#define FINGERPRINT_BAUDRATE_MAX 115200  ///< Fastest rate an R30x module accepts
+#define FINGERPRINT_RESYNCIDLE 3  ///< Quiet milliseconds after a dropped frame before its reply is given up on
+#define FINGERPRINT_IDENTIFYTIMEOUTS 2  ///< Unanswered Identify commands in a row, before one was ever answered, after which identify() stops sending it
+#define FINGERPRINT_PROBETIMEOUT 100  ///< How long detectBaudRate() waits for an answer at each rate, in milliseconds
+
+#define FINGERPRINT_STATSBUCKETS 16  ///< Latency histogram buckets per command code
+#define FINGERPRINT_STATSBASE 512  ///< Upper bound of the first bucket in microseconds; each next bucket doubles it
+#ifndef FINGERPRINT_STATSCOMMANDS
+#define FINGERPRINT_STATSCOMMANDS 8  ///< Command codes given a histogram, in order of first use
+#endif
+
+#ifndef FINGERPRINT_TRACESIZE
+#define FINGERPRINT_TRACESIZE 64  ///< Entries in the trace ring buffer; the oldest are overwritten
+#endif
+#define FINGERPRINT_TRACEMAGIC 0x7E  ///< First byte of every drainTrace() block
+#define FINGERPRINT_TRACE_TX 0x01  ///< Trace entry: byte sent to the sensor
+#define FINGERPRINT_TRACE_RX 0x02  ///< Trace entry: byte read from the sensor
+#define FINGERPRINT_TRACE_FRAME 0x03  ///< Trace entry: received frame complete, value is FINGERPRINT_OK or FINGERPRINT_BADPACKET
+#define FINGERPRINT_TRACE_DROP 0x04  ///< Trace entry: frame dropped for a corrupt header, value is the offending byte
+#define FINGERPRINT_TRACE_TIMEOUT 0x05  ///< Trace entry: gave up waiting for the sensor
+#ifndef FINGERPRINT_RECORDERSIZE
+#define FINGERPRINT_RECORDERSIZE 32  ///< Entries an Adafruit_Fingerprint_Recorder buffers before writing a block
+#endif
+
+#define FINGERPRINT_DEFAULTCAPACITY 0xA3  ///< Pages searched when the library size is not known
+#define FINGERPRINT_NOPAGE 0xFFFF  ///< No library page, e.g. an empty hot-set entry
+#define FINGERPRINT_NOSENSOR 0xFF  ///< No sensor, e.g. Adafruit_Fingerprint_Manager::poll() with nothing to report
+#define FINGERPRINT_DEFAULTADDRESS 0xFFFFFFFF  ///< Module address out of the box
+#define FINGERPRINT_TEMPLATESIZE 512  ///< Bytes in one character file / template
+#define FINGERPRINT_DEFAULTPACKETSIZE 128  ///< Module's data packet payload size out of the box
+#define FINGERPRINT_MINPACKETSIZE 32  ///< Smallest data packet payload a module can be set to
+#define FINGERPRINT_MAXPACKETSIZE 256  ///< Largest data packet payload a module can be set to
+#ifndef FINGERPRINT_MAXPAYLOAD
+  #define FINGERPRINT_MAXPAYLOAD 64  ///< Payload bytes an Adafruit_Fingerprint_Packet can hold; use Adafruit_Fingerprint_SizedPacket for other sizes
+#endif
+#define FINGERPRINT_TEMPLATE_RAW 0  ///< Adafruit_Fingerprint_Template bytes are stored as is
+#define FINGERPRINT_TEMPLATE_RLE 1  ///< Adafruit_Fingerprint_Template bytes are run-length coded, see storeTemplateRLE_P()
+#define FINGERPRINT_BACKUPMAGIC 0xA5  ///< First byte of every exportLibrary() record
+#define FINGERPRINT_BACKUPEND 0xFFFF  ///< Slot number of the record that closes an exportLibrary() stream
+#define FINGERPRINT_INDEXTABLESIZE 32  ///< Bytes in one ReadIndexTable bitmap, covering 256 pages
+#define FINGERPRINT_REPLYSIZE (1 + FINGERPRINT_INDEXTABLESIZE)  ///< Longest ACK payload the library reads: ReadIndexTable's code and bitmap
+#define FINGERPRINT_HEADERSIZE 9  ///< Start code, address, type and length ahead of every payload
+#define FINGERPRINT_CHUNKSIZE 32  ///< Bytes pulled from a template source or pushed to a sink per call
+
+/// Produces the next <b>len</b> template bytes into <b>buffer</b> for a download, returns how many it wrote
+typedef uint16_t (*Adafruit_Fingerprint_Source)(uint8_t *buffer, uint16_t len, void *context);
+/// Consumes <b>len</b> template or image bytes received from the sensor during an upload
+typedef void (*Adafruit_Fingerprint_Sink)(const uint8_t *data, uint16_t len, void *context);
+/// Told the command code and result of each command poll() completes
+typedef void (*Adafruit_Fingerprint_Callback)(uint8_t command, uint8_t result, void *context);
+
+///! One recorded UART event; drainTrace() sends it as time (4 bytes, MSB first), kind, value
+struct Adafruit_Fingerprint_TraceEntry {
+  uint32_t time;            ///< micros() when it happened
+  uint8_t kind;             ///< FINGERPRINT_TRACE_TX, _RX, _FRAME, _DROP or _TIMEOUT
+  uint8_t value;            ///< The byte, or the marker's detail
+};
+
+#ifdef FINGERPRINT_STATS
+///! Send-to-ACK latency histogram of one command code
+struct Adafruit_Fingerprint_CommandStats {
+  uint8_t opcode;           ///< Command code, 0 while the entry is unused
+  uint16_t count;           ///< Commands that got their ACK
+  uint32_t maxMicros;       ///< Slowest of them
+  uint16_t buckets[FINGERPRINT_STATSBUCKETS];  ///< Bucket b counts times under FINGERPRINT_STATSBASE << b us; the last one also everything slower
+};
+
+///! What the library counts when built with FINGERPRINT_STATS
+struct Adafruit_Fingerprint_Stats {
+  Adafruit_Fingerprint_CommandStats commands[FINGERPRINT_STATSCOMMANDS];  ///< The first command codes sent
+  uint16_t timeouts;        ///< Replies that never arrived
+  uint16_t badPackets;      ///< Replies with a bad checksum or packet type
+  uint16_t resyncs;         ///< Frames dropped for a corrupt header while hunting for the next start code
+};
+#endif
+
+///! Compile-time sum of a list of bytes, for precomputing checksums
+template <uint8_t... Bytes>
+struct Adafruit_Fingerprint_Sum {
+  static const uint16_t value = 0;  ///< Sum of no bytes
+};
+
+///! Compile-time sum of a list of bytes, for precomputing checksums
+template <uint8_t First, uint8_t... Rest>
+struct Adafruit_Fingerprint_Sum<First, Rest...> {
+  static const uint16_t value = First + Adafruit_Fingerprint_Sum<Rest...>::value;  ///< Sum of the bytes
+};
+
+///! Compile-time encoding of a command: the opcode plus any parameters that
+///  never change, followed by <b>Variable</b> bytes filled in at run time
+template <uint8_t Variable, uint8_t Opcode, uint8_t... Fixed>
+struct Adafruit_Fingerprint_Command {
+  static const uint8_t payload = 1 + sizeof...(Fixed) + Variable;       ///< Payload bytes
+  static const uint8_t size = FINGERPRINT_HEADERSIZE + payload + 2;     ///< Bytes on the wire
+  /// Checksum over everything but the variable bytes
+  static const uint16_t checksum = FINGERPRINT_COMMANDPACKET + ((payload + 2) >> 8) +
+                                   ((payload + 2) & 0xFF) + Adafruit_Fingerprint_Sum<Opcode, Fixed...>::value;
+};
+
+///! A template kept in flash, to be stored at a fixed library page; declare
+///  both the template bytes and the bank of these entries PROGMEM
+struct Adafruit_Fingerprint_Template {
+  uint16_t id;              ///< Library page to store the template at
+  const uint8_t *data;      ///< PROGMEM address of the template bytes
+  uint16_t length;          ///< Template bytes, usually FINGERPRINT_TEMPLATESIZE; for RLE the size once decoded
+  uint8_t encoding;         ///< FINGERPRINT_TEMPLATE_RAW (the default) or FINGERPRINT_TEMPLATE_RLE
+};
+
+///! Fields every UART packet carries ahead of its payload
+struct Adafruit_Fingerprint_PacketHeader {
+  /// Empty header, to be filled in by getStructuredPacket()
+  Adafruit_Fingerprint_PacketHeader() : start_code(FINGERPRINT_STARTCODE), type(0), length(0) {
+    address[0] = 0xFF; address[1] = 0xFF;
+    address[2] = 0xFF; address[3] = 0xFF;
+  }
+  uint16_t start_code;      ///< "Wakeup" code for packet detection
+  uint8_t address[4];       ///< 32-bit Fingerprint sensor address
+  uint8_t type;             ///< Type of packet
+  uint16_t length;          ///< Length of payload
+};
+
+///! Helper class to craft UART packets holding up to <b>N</b> payload bytes
+template <uint16_t N>
+struct Adafruit_Fingerprint_SizedPacket : Adafruit_Fingerprint_PacketHeader {
+
+  /// Empty packet, to be filled in by getStructuredPacket()
+  Adafruit_Fingerprint_SizedPacket() {}
 
 /**************************************************************************/
 /*!
@@ -91,22 +228,42 @@ struct Adafruit_Fingerprint_Packet {
 */
 /**************************************************************************/
 
-  Adafruit_Fingerprint_Packet(uint8_t type, uint16_t length, uint8_t * data) {
-    this->start_code = FINGERPRINT_STARTCODE;
+  Adafruit_Fingerprint_SizedPacket(uint8_t type, uint16_t length, uint8_t * data) {
     this->type = type;
     this->length = length;
-    address[0] = 0xFF; address[1] = 0xFF;
-    address[2] = 0xFF; address[3] = 0xFF;
-    if(length<64)
+    if(length<N)
       memcpy(this->data, data, length);
     else
-      memcpy(this->data, data, 64);
+      memcpy(this->data, data, N);
   }
-  uint16_t start_code;      ///< "Wakeup" code for packet detection
-  uint8_t address[4];       ///< 32-bit Fingerprint sensor address
-  uint8_t type;             ///< Type of packet
-  uint16_t length;          ///< Length of packet
-  uint8_t data[64];         ///< The raw buffer for packet payload
+  uint8_t data[N];          ///< The raw buffer for packet payload
+};
+
+/// The packet size the library has always used; commands and ACKs fit with room to spare
+typedef Adafruit_Fingerprint_SizedPacket<FINGERPRINT_MAXPAYLOAD> Adafruit_Fingerprint_Packet;
+
+///! A line to the sensor that the library can open, and reopen at another
+///  rate, by itself, which begin(), detectBaudRate() and setBaudRate() need
+///  and a plain Stream does not offer. Backends are in lib/fingerprint_transport.
+class Adafruit_Fingerprint_Transport : public Stream {
+ public:
+  /// Open the line at <b>baud</b>, or move it to that rate if open already
+  virtual void begin(unsigned long baud) = 0;
+};
+
+///! How the receive loops reach a port of type <b>PortT</b>: with calls bound
+///  at compile time, which the compiler can inline, when the type is concrete
+template <class PortT, bool Abstract = __is_abstract(PortT)>
+struct Adafruit_Fingerprint_Port {
+  static int available(PortT *port) { return port->PortT::available(); }
+  static int read(PortT *port) { return port->PortT::read(); }
+};
+
+///! An abstract port, such as a plain Stream, is reached through its vtable
+template <class PortT>
+struct Adafruit_Fingerprint_Port<PortT, true> {
+  static int available(PortT *port) { return port->available(); }
+  static int read(PortT *port) { return port->read(); }
 };
 
 ///! Helper class to communicate with and keep state for fingerprint sensors
@@ -116,8 +273,16 @@ class Adafruit_Fingerprint {
   Adafruit_Fingerprint(SoftwareSerial *ss, uint32_t password = 0x0);
 #endif
   Adafruit_Fingerprint(HardwareSerial *hs, uint32_t password = 0x0);
+  Adafruit_Fingerprint(Stream *serial, uint32_t password = 0x0);
+  Adafruit_Fingerprint(Adafruit_Fingerprint_Transport *line, uint32_t password = 0x0);
 
   void begin(uint32_t baud);
+  uint32_t begin(uint32_t baud, uint32_t maxBaud);
+  uint32_t detectBaudRate(uint32_t first = 57600);
+  uint8_t setBaudRate(uint32_t baud);
+  uint8_t writeRegister(uint8_t reg, uint8_t value);
+  uint8_t getParameters(void);
+  uint8_t setPacketSize(uint16_t bytes);
 
   boolean verifyPassword(void);
   uint8_t getImage(void);
@@ -125,37 +290,844 @@ class Adafruit_Fingerprint {
   uint8_t createModel(void);
 
   uint8_t emptyDatabase(void);
-  uint8_t storeModel(uint16_t id);
-  uint8_t loadModel(uint16_t id);
+  uint8_t storeModel(uint16_t id, uint8_t slot = 1);
+  uint8_t loadModel(uint16_t id, uint8_t slot = 1);
   uint8_t getModel(void);
-  uint8_t deleteModel(uint16_t id);
+  uint8_t deleteModel(uint16_t id, uint16_t count = 1);
+  uint8_t getMatch(void);
+  uint8_t verify(uint16_t id);
+  uint8_t identify(void);
   uint8_t fingerFastSearch(void);
+  uint8_t search(uint16_t start, uint16_t count, uint8_t slot = 1);
   uint8_t getTemplateCount(void);
+  uint8_t readIndexTable(uint8_t table, uint8_t *bitmap);
   uint8_t setPassword(uint32_t password);
-  void writeStructuredPacket(const Adafruit_Fingerprint_Packet &p);
-  uint8_t getStructuredPacket(Adafruit_Fingerprint_Packet *p, uint16_t timeout=DEFAULTTIMEOUT);
-  uint8_t uploadModel(void);
-  void sendCommandDownload(void);
-  void sendDatapacketDownload(uint8_t packet[]);
+  uint8_t setAddress(uint32_t address);
+  void useAddress(uint32_t address);
+  /// The Stream the sensor is reached through
+  Stream *serial(void) const { return mySerial; }
+  /// Send a packet of any size, see writeFrame()
+  template <uint16_t N>
+  void writeStructuredPacket(const Adafruit_Fingerprint_SizedPacket<N> &p) {
+    writeFrame(p, p.data, N);
+  }
+  /// Receive a packet of any size, see readFrame()
+  template <uint16_t N>
+  uint8_t getStructuredPacket(Adafruit_Fingerprint_SizedPacket<N> *p, uint16_t timeout=DEFAULTTIMEOUT) {
+    return readFrame(p, p->data, N, timeout);
+  }
+  uint8_t downloadModel(const uint8_t *data, uint16_t length, uint8_t slot = 1);
+  uint8_t downloadModel(Adafruit_Fingerprint_Source source, void *context, uint16_t length, uint8_t slot = 1);
+  uint8_t storeTemplate(uint16_t id, const uint8_t *data, uint16_t length = FINGERPRINT_TEMPLATESIZE);
+  uint8_t storeTemplate(uint16_t id, Adafruit_Fingerprint_Source source, void *context, uint16_t length = FINGERPRINT_TEMPLATESIZE);
+  uint8_t storeTemplate_P(uint16_t id, const uint8_t *data, uint16_t length = FINGERPRINT_TEMPLATESIZE);
+  uint8_t storeTemplate_P(const Adafruit_Fingerprint_Template *entry);
+  uint8_t storeTemplateRLE_P(uint16_t id, const uint8_t *data, uint16_t length = FINGERPRINT_TEMPLATESIZE);
+  uint8_t storeTemplateBank(const Adafruit_Fingerprint_Template *bank, uint8_t count);
+  uint8_t uploadModel(Adafruit_Fingerprint_Sink sink, void *context, uint8_t slot = 1);
+  uint8_t uploadModel(uint8_t *buffer, uint16_t size, uint8_t slot = 1);
+  uint8_t uploadImage(Adafruit_Fingerprint_Sink sink, void *context);
+  uint8_t exportLibrary(Print &out, uint16_t first = 0, uint16_t count = 0);
+  void reservePages(uint16_t first, uint16_t count, const uint16_t *copyOf = NULL);
 
-  /// The matching location that is set by fingerFastSearch()
+  uint8_t beginGetImage(void);
+  uint8_t beginImage2Tz(uint8_t slot = 1);
+  uint8_t beginStoreModel(uint16_t id, uint8_t slot = 1);
+  uint8_t beginLoadModel(uint16_t id, uint8_t slot = 1);
+  uint8_t beginDeleteModel(uint16_t id, uint16_t count = 1);
+  uint8_t beginMatch(void);
+  uint8_t beginSearch(void);
+  uint8_t beginSearch(uint16_t start, uint16_t count, uint8_t slot = 1);
+  uint8_t beginTemplateCount(void);
+  uint8_t poll(void);
+  uint8_t status(void);
+  void setCallback(Adafruit_Fingerprint_Callback cb, void *context = NULL);
+#ifdef FINGERPRINT_STATS
+  void printStats(Print &out);
+  void resetStats(void);
+
+  /// Latencies and error counts since construction or resetStats()
+  Adafruit_Fingerprint_Stats stats;
+#endif
+#ifdef FINGERPRINT_TRACE
+  uint16_t drainTrace(Print &out);
+#endif
+
+  /// The matching location that is set by fingerFastSearch(), search(), verify() and identify(); a copy on a reserved page reports the page it copies
   uint16_t fingerID;
-  /// The confidence of the fingerFastSearch() match, higher numbers are more confidents
+  /// The confidence of the fingerFastSearch() or getMatch() match, higher numbers are more confidents
   uint16_t confidence;
-  /// The number of stored templates in the sensor, set by getTemplateCount()
+  /// The number of stored templates in the sensor, set by getTemplateCount(); copies on reserved pages are not counted
   uint16_t templateCount;
+  /// The UART rate in use, set by begin(), detectBaudRate() and setBaudRate()
+  uint32_t baudRate;
+  /// Payload bytes per data packet, must match the module's setting (128 out of the box). Set by getParameters() and setPacketSize()
+  uint16_t packetLength;
+  /// The sensor's status register, set by getParameters()
+  uint16_t statusRegister;
+  /// The sensor's system identifier code, set by getParameters()
+  uint16_t systemID;
+  /// The number of template pages in the sensor's library, set by getParameters()
+  uint16_t capacity;
+  /// The sensor's match security level (1-5), set by getParameters()
+  uint16_t securityLevel;
+  /// The sensor's 32-bit module address, set by getParameters()
+  uint32_t deviceAddress;
+  /// The number of data bytes received by the last uploadModel() or uploadImage()
+  uint16_t transferLength;
+
+ protected:
+  /// Parse the bytes waiting on the line, see parseFrom()
+  virtual uint8_t parseAvailable(Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity);
+  /// Read exactly <b>size</b> bytes, see receiveFrom()
+  virtual uint8_t receiveBytes(uint8_t *buffer, uint16_t size, uint16_t timeout);
+  template <class PortT>
+  uint8_t parseFrom(PortT *port, Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity);
+  template <class PortT>
+  uint8_t receiveFrom(PortT *port, uint8_t *buffer, uint16_t size, uint16_t timeout);
 
  private:
+  void init(uint32_t password);
   uint8_t checkPassword(void);
+  void openSerial(uint32_t baud);
+  boolean probeBaudRate(uint32_t baud);
+  uint8_t writeDataPackets(Adafruit_Fingerprint_Source source, void *context, uint16_t length);
+  uint8_t readDataPackets(Adafruit_Fingerprint_Sink sink, void *context, uint8_t *buffer, uint16_t size);
+  uint8_t readByte(uint8_t *byte, uint16_t timeout) { return receiveBytes(byte, 1, timeout); }
+  static uint16_t progmemSource(uint8_t *buffer, uint16_t len, void *context);
+  static uint16_t rleSource(uint8_t *buffer, uint16_t len, void *context);
+  static void exportSink(const uint8_t *data, uint16_t len, void *context);
+  uint16_t nextStored(uint16_t page, uint16_t end, uint8_t *bitmap, uint8_t *table);
+  uint16_t homePage(uint16_t page) const;
+  uint16_t fillPacketHeader(uint8_t *header, uint8_t type, uint16_t length);
+  void finishPending(void);
+  uint8_t waitForResult(uint8_t started);
+  uint8_t sendCommand(uint8_t *frame, uint8_t size, uint16_t sum, const uint8_t *params, uint8_t count);
+
+  /// Send a command whose frame, checksum included, is fixed at compile time
+  template <uint8_t Opcode, uint8_t... Fixed>
+  uint8_t startCommand(void) {
+    return encodeCommand<0, Opcode, Fixed...>(NULL);
+  }
+  /// Send a command, appending the run-time <b>params</b> to its fixed part
+  template <uint8_t Opcode, uint8_t... Fixed, size_t N>
+  uint8_t startCommand(const uint8_t (&params)[N]) {
+    return encodeCommand<N, Opcode, Fixed...>(params);
+  }
+  /// Finish any command in flight, startCommand() and wait for the ACK,
+  /// returning its confirmation code
+  template <uint8_t Opcode, uint8_t... Fixed>
+  uint8_t runCommand(void) {
+    finishPending();
+    return waitForResult(startCommand<Opcode, Fixed...>());
+  }
+  /// Finish any command in flight, startCommand() and wait for the ACK,
+  /// returning its confirmation code
+  template <uint8_t Opcode, uint8_t... Fixed, size_t N>
+  uint8_t runCommand(const uint8_t (&params)[N]) {
+    finishPending();
+    return waitForResult(startCommand<Opcode, Fixed...>(params));
+  }
+  template <uint8_t N, uint8_t Opcode, uint8_t... Fixed>
+  uint8_t encodeCommand(const uint8_t *params) {
+    typedef Adafruit_Fingerprint_Command<N, Opcode, Fixed...> Command;
+    // address and the variable bytes are patched in by sendCommand()
+    uint8_t frame[Command::size] = {
+      FINGERPRINT_STARTCODE >> 8, FINGERPRINT_STARTCODE & 0xFF, 0, 0, 0, 0,
+      FINGERPRINT_COMMANDPACKET, (Command::payload + 2) >> 8, (Command::payload + 2) & 0xFF,
+      Opcode, Fixed...
+    };
+    return sendCommand(frame, Command::size, Command::checksum, params, N);
+  }
+  uint8_t receiveReply(void);
+#ifdef FINGERPRINT_STATS
+  uint8_t countFailure(uint8_t p);
+  void recordLatency(uint8_t opcode, uint32_t elapsed);
+#else
+  uint8_t countFailure(uint8_t p) { return p; }
+#endif
+#ifdef FINGERPRINT_TRACE
+  void trace(uint8_t kind, uint8_t value);
+  void traceBytes(uint8_t kind, const uint8_t *data, uint16_t length);
+  uint8_t traceRead(int value);
+#else
+  void trace(uint8_t, uint8_t) {}
+#endif
+  /// A byte just read from the line, logged as FINGERPRINT_TRACE_RX when tracing
+  uint8_t received(int value) {
+#ifdef FINGERPRINT_TRACE
+    return traceRead(value);
+#else
+    return value;
+#endif
+  }
+  void writeFrame(const Adafruit_Fingerprint_PacketHeader &header, const uint8_t *data, uint16_t capacity);
+  uint8_t readFrame(Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity, uint16_t timeout);
+  uint8_t parseByte(Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity, uint8_t byte);
+  uint8_t dropFrame(Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity, uint8_t byte);
+  uint8_t rescan(Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity, uint8_t byte);
   uint32_t thePassword;
   uint32_t theAddress;
-    uint8_t recvPacket[20];
+  boolean autoIdentify;               ///< identify() sends FINGERPRINT_IDENTIFY
+  boolean autoIdentifyKnown;          ///< The module has answered FINGERPRINT_IDENTIFY
+  uint8_t identifyTimeouts;           ///< FINGERPRINT_IDENTIFY commands in a row that got no reply
+  uint16_t reservedFirst;             ///< First page set aside by reservePages()
+  uint16_t reservedCount;             ///< Pages set aside, 0 for none
+  const uint16_t *reservedCopyOf;     ///< Own page of the copy held on each reserved page, or NULL
+
+  Adafruit_Fingerprint_SizedPacket<FINGERPRINT_REPLYSIZE> reply;  ///< ACK of the command in flight
+  uint16_t rxIndex;                   ///< Bytes of the incoming packet parsed so far
+  uint16_t rxSum;                     ///< Running checksum of the incoming packet
+  boolean rxDropped;                  ///< A frame with a corrupt header was skipped
+  unsigned long rxLastByte;           ///< millis() of the last bytes parseFrom() read
+  uint8_t commandOpcode;              ///< Instruction code of the last command sent
+  uint8_t commandState;               ///< FINGERPRINT_BUSY, or how receiving the last ACK ended
+  uint8_t commandResult;              ///< What poll() reports once the command completes
+  unsigned long commandStart;         ///< millis() when the command was sent
+#ifdef FINGERPRINT_STATS
+  unsigned long commandMicros;        ///< micros() when the command was sent
+#endif
+  Adafruit_Fingerprint_Callback callback;
+  void *callbackContext;
+#ifdef FINGERPRINT_TRACE
+  Adafruit_Fingerprint_TraceEntry traceBuffer[FINGERPRINT_TRACESIZE];
+  uint16_t traceHead;                 ///< Where the next entry goes
+  uint16_t traceCount;                ///< Entries held
+  uint16_t traceLost;                 ///< Entries overwritten since the last drainTrace()
+#endif
 
   Stream *mySerial;
 #if defined(__AVR__) || defined(ESP8266) || defined(FREEDOM_E300_HIFIVE1)
   SoftwareSerial *swSerial;
 #endif
   HardwareSerial *hwSerial;
+  Adafruit_Fingerprint_Transport *transport;
+};
+
+/**************************************************************************/
+/*!
+    @brief   Feed the bytes waiting on <b>port</b> to parseByte() until a
+             frame ends or the line runs dry
+    @param   port The line, as its own type so the calls can be inlined
+    @param   header Where the frame is assembled
+    @param   data Payload buffer
+    @param   capacity Bytes <b>data</b> can take
+    @returns What parseByte() returned for the last byte, or FINGERPRINT_BUSY
+             when the frame isn't complete yet
+*/
+/**************************************************************************/
+template <class PortT>
+uint8_t Adafruit_Fingerprint::parseFrom(PortT *port, Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity) {
+  typedef Adafruit_Fingerprint_Port<PortT> Port;
+  if (!Port::available(port))
+    return FINGERPRINT_BUSY;
+  // the loop drains what has arrived in well under a millisecond
+  rxLastByte = millis();
+  do {
+    uint8_t p = parseByte(header, data, capacity, received(Port::read(port)));
+    if (p != FINGERPRINT_BUSY)
+      return p;
+  } while (Port::available(port));
+  return FINGERPRINT_BUSY;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Read exactly <b>size</b> bytes from <b>port</b>
+    @param   port The line, as its own type so the calls can be inlined
+    @param   buffer Where the bytes go
+    @param   size Bytes to read
+    @param   timeout Milliseconds to wait for each byte
+    @returns FINGERPRINT_OK, or FINGERPRINT_TIMEOUT when the line went quiet
+*/
+/**************************************************************************/
+template <class PortT>
+uint8_t Adafruit_Fingerprint::receiveFrom(PortT *port, uint8_t *buffer, uint16_t size, uint16_t timeout) {
+  typedef Adafruit_Fingerprint_Port<PortT> Port;
+  uint16_t timer = 0;
+
+  while (size) {
+    if (Port::available(port)) {
+      *buffer++ = received(Port::read(port));
+      size--;
+      timer = 0;
+      continue;
+    }
+    delay(1);
+    if (++timer >= timeout) {
+      trace(FINGERPRINT_TRACE_TIMEOUT, 0);
+      return FINGERPRINT_TIMEOUT;
+    }
+  }
+  return FINGERPRINT_OK;
+}
+
+///! Adafruit_Fingerprint bound at compile time to a port of type
+///  <b>SerialT</b>, e.g. HardwareSerial, SoftwareSerial or
+///  Adafruit_Fingerprint_Termios, so the receive loops call its available()
+///  and read() directly instead of through Stream's vtable, one call per
+///  byte. <b>SerialT</b> must be the port's own class, not a base of it: a
+///  subclass's overrides would be skipped. Everything taking an
+///  Adafruit_Fingerprint, e.g. Adafruit_Fingerprint_Manager, takes this too.
+template <class SerialT>
+class Adafruit_Fingerprint_T : public Adafruit_Fingerprint {
+ public:
+  /// As Adafruit_Fingerprint(), with the constructor matching <b>SerialT</b>
+  Adafruit_Fingerprint_T(SerialT *serial, uint32_t password = 0x0)
+    : Adafruit_Fingerprint(serial, password), port(serial) {}
+
+ protected:
+  uint8_t parseAvailable(Adafruit_Fingerprint_PacketHeader *header, uint8_t *data, uint16_t capacity) {
+    return parseFrom(port, header, data, capacity);
+  }
+  uint8_t receiveBytes(uint8_t *buffer, uint16_t size, uint16_t timeout) {
+    return receiveFrom(port, buffer, size, timeout);
+  }
+
+ private:
+  SerialT *port;
+};
+
+///! Pass-through Stream that records every byte between the library and the
+///  sensor, with its micros() time, as drainTrace() blocks: give it to the
+///  Adafruit_Fingerprint(Stream *) constructor in place of the sensor's port.
+///  Open the port itself, begin() cannot reach it through a Stream.
+class Adafruit_Fingerprint_Recorder : public Stream {
+ public:
+  Adafruit_Fingerprint_Recorder(Stream *line, Print *log);
+
+  int available(void);
+  int read(void);
+  int peek(void);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+  void flush(void);
+  uint16_t flushLog(void);
+
+ private:
+  void record(uint8_t kind, uint8_t value);
+
+  Stream *line;                       ///< The sensor's port
+  Print *log;                         ///< Where full blocks go
+  Adafruit_Fingerprint_TraceEntry entries[FINGERPRINT_RECORDERSIZE];
+  uint16_t count;                     ///< Entries not yet written to the log
+};
+
+///! Stream that plays the sensor's side of a recorded transcript (drainTrace()
+///  or Adafruit_Fingerprint_Recorder blocks) back to the library. Received
+///  bytes are held back until the library has sent everything that preceded
+///  them and, unless the speed is 0, until as long after the last byte sent
+///  as they came in the recording. Markers in the transcript are skipped.
+class Adafruit_Fingerprint_Replay : public Stream {
+ public:
+  Adafruit_Fingerprint_Replay(const uint8_t *transcript, size_t length, uint8_t speed = 1);
+
+  int available(void);
+  int read(void);
+  int peek(void);
+  size_t write(uint8_t c);
+  using Print::write;
+  void rewind(void);
+
+  /// True once every recorded byte has been sent and read
+  bool done(void) const { return !sent.valid && !received.valid; }
+  /// Bytes the library sent that differ from the recording, or that it has no byte for
+  uint16_t mismatches(void) const { return mismatched; }
+
+ private:
+  ///! Position of the next entry of one kind
+  struct Cursor {
+    size_t offset;                    ///< Transcript byte after the entry
+    uint16_t left;                    ///< Entries left in the current block
+    uint32_t index;                   ///< Entries passed since the start, counting every kind
+    bool valid;                       ///< False once the transcript has no more of the kind
+    Adafruit_Fingerprint_TraceEntry entry;
+  };
+
+  void advance(Cursor &cursor, uint8_t kind);
+  bool due(void);
+
+  const uint8_t *transcript;
+  size_t length;
+  uint8_t speed;                      ///< 1 for recorded timing, N for N times faster, 0 for no waits
+  Cursor sent;                        ///< Next byte the library should send
+  Cursor received;                    ///< Next byte to give the library
+  bool anchored;                      ///< anchorTime and anchorMicros are set
+  uint32_t anchorTime;                ///< Recorded time of the last byte sent
+  unsigned long anchorMicros;         ///< micros() when the library sent it
+  uint16_t mismatched;
+};
+
+///! Occupancy of the first <b>Capacity</b> library pages, loaded from the
+///  module's index table, with a free-page allocator and used-page iteration
+template <uint16_t Capacity>
+class Adafruit_Fingerprint_SlotMap {
+ public:
+  Adafruit_Fingerprint_SlotMap() { clear(); }
+
+  /// Forget everything: all pages free
+  void clear(void) {
+    memset(bits, 0, sizeof(bits));
+    used = 0;
+    freeHint = 0;
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Fill the map from the sensor with one ReadIndexTable per 256 pages
+    @param   finger The sensor to ask
+    @returns <code>FINGERPRINT_OK</code> on success, else the failing readIndexTable() code
+*/
+/**************************************************************************/
+  uint8_t load(Adafruit_Fingerprint &finger) {
+    uint8_t bitmap[FINGERPRINT_INDEXTABLESIZE];
+    clear();
+    for (uint8_t table = 0; table * FINGERPRINT_INDEXTABLESIZE < (uint16_t)sizeof(bits); table++) {
+      uint8_t p = finger.readIndexTable(table, bitmap);
+      if (p != FINGERPRINT_OK)
+        return p;
+      uint16_t offset = table * FINGERPRINT_INDEXTABLESIZE;
+      for (uint8_t i = 0; i < FINGERPRINT_INDEXTABLESIZE && offset + i < sizeof(bits); i++)
+        bits[offset + i] = bitmap[i];
+    }
+    // pages past Capacity are not ours to hand out
+    if (Capacity % 8)
+      bits[sizeof(bits) - 1] &= (1 << (Capacity % 8)) - 1;
+    for (uint16_t i = 0; i < sizeof(bits); i++)
+      for (uint8_t b = bits[i]; b; b &= b - 1)
+        used++;
+    return FINGERPRINT_OK;
+  }
+
+  /// True if <b>id</b> holds a template
+  bool isUsed(uint16_t id) const {
+    return id < Capacity && (bits[id >> 3] & (1 << (id & 7)));
+  }
+
+  /// Record that <b>id</b> now holds a template
+  void markUsed(uint16_t id) {
+    if (id >= Capacity || isUsed(id)) return;
+    bits[id >> 3] |= 1 << (id & 7);
+    used++;
+  }
+
+  /// Record that <b>id</b> was deleted
+  void markFree(uint16_t id) {
+    if (!isUsed(id)) return;
+    bits[id >> 3] &= ~(1 << (id & 7));
+    used--;
+    if (id < freeHint) freeHint = id;
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Lowest free page. Amortised O(1): the search resumes where the
+             last one stopped and only moves back when a page is freed.
+    @returns The page, or <b>Capacity</b> when the library is full
+*/
+/**************************************************************************/
+  uint16_t nextFree(void) {
+    while (freeHint < Capacity) {
+      if (bits[freeHint >> 3] == 0xFF)
+        freeHint = (freeHint | 7) + 1;
+      else if (isUsed(freeHint))
+        freeHint++;
+      else
+        return freeHint;
+    }
+    return Capacity;
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Walk the used pages: pass 0 to start, then the previous result + 1
+    @param   from First page to consider
+    @returns The next used page at or after <b>from</b>, or <b>Capacity</b> when there are no more
+*/
+/**************************************************************************/
+  uint16_t nextUsed(uint16_t from) const {
+    while (from < Capacity) {
+      if (!bits[from >> 3])
+        from = (from | 7) + 1;
+      else if (isUsed(from))
+        return from;
+      else
+        from++;
+    }
+    return Capacity;
+  }
+
+  /// Number of used pages
+  uint16_t count(void) const { return used; }
+
+ private:
+  uint8_t bits[(Capacity + 7) / 8];
+  uint16_t used;
+  uint16_t freeHint;
+};
+
+///! Identification that searches a small "hot" partition of <b>Hot</b> pages
+///  first and the rest of the library only when that misses. The partition
+///  holds copies of the most often matched templates, promoted by maintain();
+///  every template keeps its own page, which is what fingerID reports.
+///  begin() reserves the partition with Adafruit_Fingerprint::reservePages(),
+///  so identify(), fingerFastSearch() and a Manager report the own page too,
+///  getTemplateCount() does not count the copies and exportLibrary() does
+///  not back them up. The hot set must outlive its use of the sensor.
+///  Up to <b>Candidates</b> recently matched cold templates are tracked as
+///  contenders for promotion.
+template <uint8_t Hot, uint8_t Candidates = 4>
+class Adafruit_Fingerprint_HotSet {
+ public:
+  Adafruit_Fingerprint_HotSet() : finger(NULL), first(0) { clear(); }
+
+/**************************************************************************/
+/*!
+    @brief   Take over pages <b>first</b> to <b>first</b> + Hot - 1 for the hot
+             copies, reserve them on <b>sensor</b> and empty them; nothing
+             may be enrolled there
+    @param   sensor The sensor to identify with
+    @param   firstPage First page of the hot partition
+    @returns <code>FINGERPRINT_OK</code> on success, else the failing getParameters() or deleteModel() code
+*/
+/**************************************************************************/
+  uint8_t begin(Adafruit_Fingerprint &sensor, uint16_t firstPage) {
+    finger = &sensor;
+    first = firstPage;
+    clear();
+    finger->reservePages(first, Hot, home);
+    if (!finger->capacity) {
+      uint8_t p = finger->getParameters();
+      if (p != FINGERPRINT_OK)
+        return p;
+    }
+    // which copies survived a restart is unknown, so start from nothing
+    return finger->deleteModel(first, Hot);
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Search for the features in char buffer 1, hot partition first.
+             On a match <b>fingerID</b> and <b>confidence</b> are set as by
+             fingerFastSearch(), with <b>fingerID</b> the template's own page.
+    @returns See Adafruit_Fingerprint::search()
+*/
+/**************************************************************************/
+  uint8_t search(void) {
+    uint8_t p = finger->search(first, Hot);
+    // the sensor already reports a copy as its own page
+    for (uint8_t i = 0; p == FINGERPRINT_OK && i < Hot; i++)
+      if (home[i] == finger->fingerID) {
+        warm(&heat[i]);
+        return FINGERPRINT_OK;
+      }
+    if (p != FINGERPRINT_OK && p != FINGERPRINT_NOTFOUND)
+      return p;
+
+    uint16_t end = first + Hot;
+    p = FINGERPRINT_NOTFOUND;
+    if (end < finger->capacity)
+      p = finger->search(end, finger->capacity - end);
+    if (p == FINGERPRINT_NOTFOUND && first)
+      p = finger->search(0, first);
+    if (p == FINGERPRINT_OK)
+      noteCold(finger->fingerID);
+    return p;
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Promote the busiest candidate over the quietest hot copy, if it
+             has clearly overtaken it. Costs a LOAD and a STORE, so call it
+             when the door is idle, e.g. from loop() after an unlock. Char
+             buffer 2 is used for the copy; buffer 1 is left alone.
+    @returns <code>FINGERPRINT_OK</code> if promoted or nothing to do, else the failing loadModel() or storeModel() code
+*/
+/**************************************************************************/
+  uint8_t maintain(void) {
+    uint8_t c = 0, h = 0;
+    for (uint8_t i = 1; i < Candidates; i++)
+      if (candidateHeat[i] > candidateHeat[c])
+        c = i;
+    for (uint8_t i = 1; i < Hot && home[h] != FINGERPRINT_NOPAGE; i++)
+      if (home[i] == FINGERPRINT_NOPAGE || heat[i] < heat[h])
+        h = i;
+    if (candidate[c] == FINGERPRINT_NOPAGE)
+      return FINGERPRINT_OK;
+    // a clear lead, so two equally busy fingers don't keep swapping places
+    if (home[h] != FINGERPRINT_NOPAGE && candidateHeat[c] <= heat[h] + 1)
+      return FINGERPRINT_OK;
+
+    uint8_t p = finger->loadModel(candidate[c], 2);
+    if (p == FINGERPRINT_OK)
+      p = finger->storeModel(first + h, 2);
+    if (p == FINGERPRINT_DBRANGEFAIL) {
+      // deleted since it was matched
+      candidate[c] = FINGERPRINT_NOPAGE;
+      candidateHeat[c] = 0;
+    }
+    if (p != FINGERPRINT_OK)
+      return p;
+
+    // the demoted template becomes a candidate with the heat it had
+    uint16_t page = home[h];
+    uint8_t score = heat[h];
+    home[h] = candidate[c];
+    heat[h] = candidateHeat[c];
+    candidate[c] = page;
+    candidateHeat[c] = score;
+    return FINGERPRINT_OK;
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Drop a template that was deleted from the library, including its hot copy
+    @param   page The template's own page
+    @returns <code>FINGERPRINT_OK</code> on success, else the failing deleteModel() code
+*/
+/**************************************************************************/
+  uint8_t forget(uint16_t page) {
+    for (uint8_t i = 0; i < Candidates; i++)
+      if (candidate[i] == page) {
+        candidate[i] = FINGERPRINT_NOPAGE;
+        candidateHeat[i] = 0;
+      }
+    for (uint8_t i = 0; i < Hot; i++)
+      if (home[i] == page) {
+        home[i] = FINGERPRINT_NOPAGE;
+        heat[i] = 0;
+        return finger->deleteModel(first + i);
+      }
+    return FINGERPRINT_OK;
+  }
+
+  /// True if <b>page</b> is in the hot partition and holds a copy
+  bool isCopy(uint16_t page) const {
+    uint16_t i = page - first;
+    return i < Hot && home[i] != FINGERPRINT_NOPAGE;
+  }
+
+  /// The own page of the template copied to <b>page</b>, or <b>page</b> itself if it holds no copy
+  uint16_t translate(uint16_t page) const {
+    return isCopy(page) ? home[page - first] : page;
+  }
+
+  /// True if <b>page</b> has a copy in the hot partition
+  bool isHot(uint16_t page) const {
+    for (uint8_t i = 0; i < Hot; i++)
+      if (home[i] == page)
+        return true;
+    return false;
+  }
+
+ private:
+  void clear(void) {
+    for (uint8_t i = 0; i < Hot; i++) {
+      home[i] = FINGERPRINT_NOPAGE;
+      heat[i] = 0;
+    }
+    for (uint8_t i = 0; i < Candidates; i++) {
+      candidate[i] = FINGERPRINT_NOPAGE;
+      candidateHeat[i] = 0;
+    }
+  }
+
+  /// Count a match; when a counter is about to wrap, everything ages by half
+  void warm(uint8_t *score) {
+    if (*score == 0xFF) {
+      for (uint8_t i = 0; i < Hot; i++) heat[i] >>= 1;
+      for (uint8_t i = 0; i < Candidates; i++) candidateHeat[i] >>= 1;
+    }
+    (*score)++;
+  }
+
+  /// Count a match outside the hot partition; a newcomer takes the place of
+  /// the quietest candidate and inherits its count, so it can catch up
+  void noteCold(uint16_t page) {
+    uint8_t c = 0;
+    for (uint8_t i = 0; i < Candidates; i++) {
+      if (candidate[i] == page) {
+        warm(&candidateHeat[i]);
+        return;
+      }
+      if (candidateHeat[i] < candidateHeat[c])
+        c = i;
+    }
+    candidate[c] = page;
+    warm(&candidateHeat[c]);
+  }
+
+  Adafruit_Fingerprint *finger;
+  uint16_t first;                     ///< First page of the hot partition
+  uint16_t home[Hot];                 ///< Own page of each hot copy, FINGERPRINT_NOPAGE if empty
+  uint8_t heat[Hot];                  ///< Recent matches of each hot copy
+  uint16_t candidate[Candidates];     ///< Cold pages matched lately
+  uint8_t candidateHeat[Candidates];  ///< Recent matches of each candidate
+};
+
+///! Keeps up to <b>N</b> sensors scanning at once, e.g. the entry and exit
+///  readers of a door pair, and reports each identification as it comes.
+///  Every sensor runs getImage, image2Tz and a search of its whole library
+///  as non-blocking commands started and collected by poll(), so one module
+///  busy searching never holds up another. Sensors on separate UARTs work
+///  in parallel; sensors sharing one (told apart with setAddress()) take
+///  turns, one command in flight per Stream.
+template <uint8_t N>
+class Adafruit_Fingerprint_Manager {
+ public:
+  Adafruit_Fingerprint_Manager() : count(0), next(0) {}
+
+/**************************************************************************/
+/*!
+    @brief   Take a sensor into the rotation. It must be opened and, if it
+             has a password, verified already, and its non-blocking
+             commands are the manager's from now on. Reads the library size
+             with getParameters() if it is not known yet.
+    @param   finger The sensor
+    @returns Its index for result(), fingerID() and the like, or <code>FINGERPRINT_NOSENSOR</code> if all <b>N</b> are taken
+*/
+/**************************************************************************/
+  uint8_t add(Adafruit_Fingerprint &finger) {
+    if (count == N)
+      return FINGERPRINT_NOSENSOR;
+    // so the searches cover the whole library
+    if (!finger.capacity)
+      finger.getParameters();
+    Reader &r = readers[count];
+    r.finger = &finger;
+    r.step = FINGERPRINT_GETIMAGE;
+    r.running = false;
+    r.lifted = true;
+    r.fresh = false;
+    r.result = FINGERPRINT_NOFINGER;
+    r.fingerID = FINGERPRINT_NOPAGE;
+    r.confidence = 0;
+    return count++;
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Collect finished commands and start the next ones; call it from
+             loop() as often as possible. A finger is reported once per
+             touch: its sensor waits for it to be lifted before scanning again.
+    @returns Index of a sensor with a new result, else <code>FINGERPRINT_NOSENSOR</code>.
+             When several have one, the others come out of the next calls.
+*/
+/**************************************************************************/
+  uint8_t poll(void) {
+    for (uint8_t i = 0; i < count; i++)
+      if (readers[i].running)
+        collect(readers[i]);
+
+    // idle sensors start in turn, so two sharing a UART alternate
+    for (uint8_t n = 0; n < count; n++) {
+      uint8_t i = (next + n) % count;
+      if (!readers[i].running && lineFree(readers[i].finger->serial()) && start(readers[i]))
+        next = (i + 1) % count;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+      if (readers[i].fresh) {
+        readers[i].fresh = false;
+        return i;
+      }
+    return FINGERPRINT_NOSENSOR;
+  }
+
+/**************************************************************************/
+/*!
+    @brief   Wait for the commands in flight to finish, so the sensors can be
+             used directly, e.g. to enroll. The next poll() starts over with
+             a fresh scan on every sensor.
+*/
+/**************************************************************************/
+  void stop(void) {
+    for (uint8_t i = 0; i < count; i++) {
+      Reader &r = readers[i];
+      if (r.running)
+        while (r.finger->poll() == FINGERPRINT_BUSY)
+          delay(1);
+      r.running = false;
+      r.step = FINGERPRINT_GETIMAGE;
+    }
+  }
+
+  /// Result of sensor <b>i</b>'s last identification: FINGERPRINT_OK, FINGERPRINT_NOTFOUND or the failing code
+  uint8_t result(uint8_t i) const { return readers[i].result; }
+  /// Page matched by sensor <b>i</b>'s last identification, FINGERPRINT_NOPAGE if it had none
+  uint16_t fingerID(uint8_t i) const { return readers[i].fingerID; }
+  /// Confidence of sensor <b>i</b>'s last match
+  uint16_t confidence(uint8_t i) const { return readers[i].confidence; }
+  /// Sensor <b>i</b> as given to add()
+  Adafruit_Fingerprint &sensor(uint8_t i) { return *readers[i].finger; }
+  /// Sensors added so far
+  uint8_t size(void) const { return count; }
+
+ private:
+  ///! Where one sensor is in its identification
+  struct Reader {
+    Adafruit_Fingerprint *finger;
+    uint8_t step;             ///< Command code being run or to run next
+    bool running;             ///< The command is in flight
+    bool lifted;              ///< No finger seen since the last report
+    bool fresh;               ///< Reported by no poll() yet
+    uint8_t result;
+    uint16_t fingerID;
+    uint16_t confidence;
+  };
+
+  bool lineFree(Stream *line) const {
+    for (uint8_t i = 0; i < count; i++)
+      if (readers[i].running && readers[i].finger->serial() == line)
+        return false;
+    return true;
+  }
+
+  bool start(Reader &r) {
+    uint8_t p;
+    if (r.step == FINGERPRINT_GETIMAGE)
+      p = r.finger->beginGetImage();
+    else if (r.step == FINGERPRINT_IMAGE2TZ)
+      p = r.finger->beginImage2Tz();
+    else
+      p = r.finger->beginSearch();
+    r.running = p == FINGERPRINT_OK;
+    return r.running;
+  }
+
+  void collect(Reader &r) {
+    uint8_t p = r.finger->poll();
+    if (p == FINGERPRINT_BUSY)
+      return;
+    r.running = false;
+
+    if (r.step == FINGERPRINT_GETIMAGE) {
+      if (p == FINGERPRINT_NOFINGER)
+        r.lifted = true;
+      // still the finger that was just reported, or nothing to report
+      if (!r.lifted || p == FINGERPRINT_NOFINGER)
+        return;
+      if (p == FINGERPRINT_OK) {
+        r.step = FINGERPRINT_IMAGE2TZ;
+        return;
+      }
+    } else if (r.step == FINGERPRINT_IMAGE2TZ && p == FINGERPRINT_OK) {
+      r.step = FINGERPRINT_HISPEEDSEARCH;
+      return;
+    }
+
+    r.result = p;
+    r.fingerID = p == FINGERPRINT_OK ? r.finger->fingerID : FINGERPRINT_NOPAGE;
+    r.confidence = p == FINGERPRINT_OK ? r.finger->confidence : 0;
+    r.fresh = true;
+    r.lifted = false;
+    r.step = FINGERPRINT_GETIMAGE;
+  }
+
+  Reader readers[N];
+  uint8_t count;
+  uint8_t next;               ///< Sensor first in line to start a command
 };
 
 #endif
@@ -0,0 +1,324 @@
+/***************************************************
+  Transports for Adafruit_Fingerprint, see fingerprint_transport.h
+ ****************************************************/
+
+#include "fingerprint_transport.h"
+
+#ifdef FINGERPRINT_USART
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#if FINGERPRINT_USART == 1
+  #define USART_UDR UDR1
+  #define USART_UCSRA UCSR1A
+  #define USART_UCSRB UCSR1B
+  #define USART_UCSRC UCSR1C
+  #define USART_UBRR UBRR1
+  #define USART_U2X U2X1
+  #define USART_MPCM MPCM1
+  #define USART_TXC TXC1
+  #define USART_UDRE UDRE1
+  #define USART_RXEN RXEN1
+  #define USART_TXEN TXEN1
+  #define USART_RXCIE RXCIE1
+  #define USART_UDRIE UDRIE1
+  #define USART_RX_VECTOR USART1_RX_vect
+  #define USART_UDRE_VECTOR USART1_UDRE_vect
+#else
+  #define USART_UDR UDR0
+  #define USART_UCSRA UCSR0A
+  #define USART_UCSRB UCSR0B
+  #define USART_UCSRC UCSR0C
+  #define USART_UBRR UBRR0
+  #define USART_U2X U2X0
+  #define USART_MPCM MPCM0
+  #define USART_TXC TXC0
+  #define USART_UDRE UDRE0
+  #define USART_RXEN RXEN0
+  #define USART_TXEN TXEN0
+  #define USART_RXCIE RXCIE0
+  #define USART_UDRIE UDRIE0
+  #if defined(USART_RX_vect)
+    #define USART_RX_VECTOR USART_RX_vect
+    #define USART_UDRE_VECTOR USART_UDRE_vect
+  #else
+    #define USART_RX_VECTOR USART0_RX_vect
+    #define USART_UDRE_VECTOR USART0_UDRE_vect
+  #endif
+#endif
+
+#define RXMASK (FINGERPRINT_USARTRXSIZE - 1)
+#define TXMASK (FINGERPRINT_USARTTXSIZE - 1)
+
+#if FINGERPRINT_USARTRXSIZE > 256 || (FINGERPRINT_USARTRXSIZE & RXMASK)
+  #error "FINGERPRINT_USARTRXSIZE must be a power of two up to 256"
+#endif
+#if FINGERPRINT_USARTTXSIZE > 256 || (FINGERPRINT_USARTTXSIZE & TXMASK)
+  #error "FINGERPRINT_USARTTXSIZE must be a power of two up to 256"
+#endif
+
+volatile uint8_t Adafruit_Fingerprint_Usart::rxBuffer[FINGERPRINT_USARTRXSIZE];
+volatile uint8_t Adafruit_Fingerprint_Usart::rxHead;
+volatile uint8_t Adafruit_Fingerprint_Usart::rxTail;
+volatile uint8_t Adafruit_Fingerprint_Usart::txBuffer[FINGERPRINT_USARTTXSIZE];
+volatile uint8_t Adafruit_Fingerprint_Usart::txHead;
+volatile uint8_t Adafruit_Fingerprint_Usart::txTail;
+volatile uint16_t Adafruit_Fingerprint_Usart::lost;
+bool Adafruit_Fingerprint_Usart::written;
+
+ISR(USART_RX_VECTOR) {
+  Adafruit_Fingerprint_Usart::receiveInterrupt();
+}
+
+ISR(USART_UDRE_VECTOR) {
+  Adafruit_Fingerprint_Usart::sendInterrupt();
+}
+
+/**************************************************************************/
+/*!
+    @brief  Open the USART at <b>baud</b>, 8N1, or change its rate. Anything
+            still in the rings is dropped.
+    @param  baud Line rate, e.g. 57600
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint_Usart::begin(unsigned long baud) {
+  flush();
+  // double speed mode, rounded to the nearest divisor, as the Arduino core does
+  uint16_t setting = (F_CPU / 4 / baud - 1) / 2;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    USART_UCSRB = 0;
+    USART_UCSRA = 1 << USART_U2X;
+    USART_UBRR = setting;
+    USART_UCSRC = 0x06;               // 8 data bits, no parity, 1 stop bit
+    rxHead = rxTail = 0;
+    txHead = txTail = 0;
+    lost = 0;
+    written = false;
+    USART_UCSRB = (1 << USART_RXEN) | (1 << USART_TXEN) | (1 << USART_RXCIE);
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Send what is queued, then switch the USART off
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint_Usart::end(void) {
+  flush();
+  USART_UCSRB = 0;
+}
+
+int Adafruit_Fingerprint_Usart::available(void) {
+  return (uint8_t)(rxHead - rxTail) & RXMASK;
+}
+
+int Adafruit_Fingerprint_Usart::read(void) {
+  uint8_t tail = rxTail;
+  if (tail == rxHead)
+    return -1;
+  uint8_t c = rxBuffer[tail];
+  rxTail = (tail + 1) & RXMASK;
+  return c;
+}
+
+int Adafruit_Fingerprint_Usart::peek(void) {
+  uint8_t tail = rxTail;
+  return tail == rxHead ? -1 : rxBuffer[tail];
+}
+
+size_t Adafruit_Fingerprint_Usart::write(uint8_t c) {
+  written = true;
+  // straight into the data register when nothing is queued ahead of it
+  if (txHead == txTail && (USART_UCSRA & (1 << USART_UDRE))) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      USART_UDR = c;
+      USART_UCSRA = (USART_UCSRA & ((1 << USART_U2X) | (1 << USART_MPCM))) | (1 << USART_TXC);
+    }
+    return 1;
+  }
+
+  uint8_t head = (txHead + 1) & TXMASK;
+  while (head == txTail) {
+    // ring full; with interrupts off (e.g. called from an ISR) nobody else empties it
+    if (!(SREG & (1 << SREG_I)) && (USART_UCSRA & (1 << USART_UDRE)))
+      sendInterrupt();
+  }
+  txBuffer[txHead] = c;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    txHead = head;
+    USART_UCSRB |= 1 << USART_UDRIE;
+  }
+  return 1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Wait until everything written has left the wire
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint_Usart::flush(void) {
+  // TXC is only meaningful once something was sent
+  if (!written)
+    return;
+  while ((USART_UCSRB & (1 << USART_UDRIE)) || !(USART_UCSRA & (1 << USART_TXC))) {
+    if (!(SREG & (1 << SREG_I)) && (USART_UCSRB & (1 << USART_UDRIE)) && (USART_UCSRA & (1 << USART_UDRE)))
+      sendInterrupt();
+  }
+}
+
+void Adafruit_Fingerprint_Usart::receiveInterrupt(void) {
+  uint8_t c = USART_UDR;
+  uint8_t head = (rxHead + 1) & RXMASK;
+  if (head == rxTail) {
+    lost++;
+    return;
+  }
+  rxBuffer[rxHead] = c;
+  rxHead = head;
+}
+
+void Adafruit_Fingerprint_Usart::sendInterrupt(void) {
+  uint8_t tail = txTail;
+  USART_UDR = txBuffer[tail];
+  // clear TXC so flush() can tell when this byte is out
+  USART_UCSRA = (USART_UCSRA & ((1 << USART_U2X) | (1 << USART_MPCM))) | (1 << USART_TXC);
+  txTail = tail = (tail + 1) & TXMASK;
+  if (tail == txHead)
+    USART_UCSRB &= ~(1 << USART_UDRIE);
+}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**************************************************************************/
+/*!
+    @brief  Instantiates a transport on a serial device; nothing is opened
+            until begin()
+    @param  path The device, e.g. /dev/ttyUSB0. Kept, not copied.
+*/
+/**************************************************************************/
+Adafruit_Fingerprint_Termios::Adafruit_Fingerprint_Termios(const char *path) {
+  this->path = path;
+  fd = -1;
+  head = tail = 0;
+}
+
+Adafruit_Fingerprint_Termios::~Adafruit_Fingerprint_Termios() {
+  end();
+}
+
+static speed_t termiosSpeed(unsigned long baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    default: return B0;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Open the device raw at <b>baud</b>, or change its rate. Unread
+            input is dropped. termios only has 9600, 19200, 38400, 57600
+            and 115200 of the R30x's rates; others leave the rate as it is.
+    @param  baud Line rate, e.g. 57600
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint_Termios::begin(unsigned long baud) {
+  if (fd < 0) {
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+      return;
+  }
+
+  struct termios tty;
+  if (tcgetattr(fd, &tty) == 0) {
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    speed_t speed = termiosSpeed(baud);
+    if (speed != B0) {
+      cfsetispeed(&tty, speed);
+      cfsetospeed(&tty, speed);
+    }
+    tcsetattr(fd, TCSANOW, &tty);
+  }
+  tcflush(fd, TCIFLUSH);
+  head = tail = 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Close the device
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint_Termios::end(void) {
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+  head = tail = 0;
+}
+
+int Adafruit_Fingerprint_Termios::available(void) {
+  fill();
+  return tail - head;
+}
+
+int Adafruit_Fingerprint_Termios::read(void) {
+  fill();
+  return head < tail ? buffer[head++] : -1;
+}
+
+int Adafruit_Fingerprint_Termios::peek(void) {
+  fill();
+  return head < tail ? buffer[head] : -1;
+}
+
+size_t Adafruit_Fingerprint_Termios::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t Adafruit_Fingerprint_Termios::write(const uint8_t *data, size_t size) {
+  size_t done = 0;
+  while (fd >= 0 && done < size) {
+    ssize_t n = ::write(fd, data + done, size - done);
+    if (n > 0) {
+      done += n;
+    } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+      // output queue full; wait for the line to drain a little
+      struct pollfd p = { fd, POLLOUT, 0 };
+      poll(&p, 1, 10);
+    } else {
+      break;
+    }
+  }
+  return done;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Wait until everything written has left the wire
+*/
+/**************************************************************************/
+void Adafruit_Fingerprint_Termios::flush(void) {
+  if (fd >= 0)
+    tcdrain(fd);
+}
+
+void Adafruit_Fingerprint_Termios::fill(void) {
+  if (head < tail || fd < 0)
+    return;
+  ssize_t n = ::read(fd, buffer, sizeof(buffer));
+  head = 0;
+  tail = n > 0 ? n : 0;
+}
+#endif
@@ -0,0 +1,104 @@
+#ifndef FINGERPRINT_TRANSPORT_H
+#define FINGERPRINT_TRANSPORT_H
+
+/***************************************************
+  Lines to the fingerprint sensor beyond the Arduino core's serial classes,
+  for the Adafruit_Fingerprint(Adafruit_Fingerprint_Transport *) constructor:
+
+  Adafruit_Fingerprint_Usart  AVR hardware USART with interrupt-driven
+                              receive and transmit rings, in place of
+                              SoftwareSerial, which blocks interrupts for
+                              every byte sent and loses bytes at 57600.
+  Adafruit_Fingerprint_Termios  A tty on a Linux (or other POSIX) host,
+                              e.g. a USB-TTL adapter, for provisioning
+                              from a gateway.
+
+  Each is only compiled where it can work.
+ ****************************************************/
+
+#include "Arduino.h"
+#include <custom_adafruit_fingerprint.h>
+
+#if defined(__AVR__)
+  #if defined(UBRR1H)
+    #define FINGERPRINT_USART 1   ///< Second USART (Mega, Leonardo); Serial keeps the first
+  #elif defined(FINGERPRINT_USE_USART0)
+    #define FINGERPRINT_USART 0   ///< The only USART (Uno); Serial must not be used
+  #endif
+#endif
+
+#ifdef FINGERPRINT_USART
+#ifndef FINGERPRINT_USARTRXSIZE
+#define FINGERPRINT_USARTRXSIZE 256  ///< Receive ring bytes, a power of two up to 256; holds 255, room for a 139-byte data packet at the default packet size
+#endif
+#ifndef FINGERPRINT_USARTTXSIZE
+#define FINGERPRINT_USARTTXSIZE 32  ///< Transmit ring bytes, a power of two up to 256
+#endif
+
+///! The USART picked by FINGERPRINT_USART, with its receive and transmit
+///  interrupts feeding ring buffers. There is one USART, so all instances
+///  share it; don't use the core's Serial object for the same one.
+class Adafruit_Fingerprint_Usart : public Adafruit_Fingerprint_Transport {
+ public:
+  void begin(unsigned long baud);
+  void end(void);
+  int available(void);
+  int read(void);
+  int peek(void);
+  size_t write(uint8_t c);
+  using Print::write;
+  void flush(void);
+  /// Bytes dropped since begin() because the receive ring was full
+  uint16_t overruns(void) const { return lost; }
+
+  static void receiveInterrupt(void);
+  static void sendInterrupt(void);
+
+ private:
+  static volatile uint8_t rxBuffer[FINGERPRINT_USARTRXSIZE];
+  static volatile uint8_t rxHead;     ///< Where the interrupt puts the next byte
+  static volatile uint8_t rxTail;     ///< Next byte for read()
+  static volatile uint8_t txBuffer[FINGERPRINT_USARTTXSIZE];
+  static volatile uint8_t txHead;     ///< Where write() puts the next byte
+  static volatile uint8_t txTail;     ///< Next byte for the interrupt
+  static volatile uint16_t lost;
+  static bool written;                ///< Something was sent since begin()
+};
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#ifndef FINGERPRINT_TERMIOSBUFFER
+#define FINGERPRINT_TERMIOSBUFFER 256  ///< Bytes taken from the tty per read()
+#endif
+
+///! A serial device on a POSIX host, opened raw (8N1, no flow control, no
+///  echo) and read without blocking, so the library's timeouts still apply
+class Adafruit_Fingerprint_Termios : public Adafruit_Fingerprint_Transport {
+ public:
+  Adafruit_Fingerprint_Termios(const char *path);
+  ~Adafruit_Fingerprint_Termios();
+
+  void begin(unsigned long baud);
+  void end(void);
+  /// True once begin() has opened the device
+  bool isOpen(void) const { return fd >= 0; }
+  int available(void);
+  int read(void);
+  int peek(void);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+  void flush(void);
+
+ private:
+  void fill(void);
+
+  const char *path;
+  int fd;
+  uint8_t buffer[FINGERPRINT_TERMIOSBUFFER];
+  uint16_t head;                      ///< Next byte for read()
+  uint16_t tail;                      ///< End of the bytes read from the device
+};
+#endif
+
+#endif
@@ -0,0 +1,554 @@
+/***************************************************
+  Simulated R301T fingerprint module, see r301t_simulator.h
+ ****************************************************/
+
+#include "r301t_simulator.h"
+
+#define R301T_MATCHSCORE 200   ///< Score reported for an exact feature match
+
+/**************************************************************************/
+/*!
+    @brief  Create a module with an empty library
+    @param  capacity Number of template pages in flash
+    @param  baudrate UART rate the module is configured for
+*/
+/**************************************************************************/
+R301T_Simulator::R301T_Simulator(uint16_t capacity, uint32_t baudrate) {
+  timing.getImage = 120000;
+  timing.noFinger = 30000;
+  timing.image2Tz = 180000;
+  timing.searchBase = 2000;
+  timing.searchPerPage = 300;
+  timing.match = 20000;
+  timing.load = 15000;
+  timing.store = 35000;
+  timing.erase = 20000;
+  timing.transfer = 1000;
+  timing.command = 500;
+
+  indexTable = true;
+  autoIdentify = true;
+  identifySilent = false;
+  libraryCapacity = capacity;
+  moduleBaud = baudrate;
+  hostBaud = 0;
+  dataPacketSize = 128;
+  password = 0;
+  moduleAddress = FINGERPRINT_DEFAULTADDRESS;
+  securityLevel = 3;
+  library.resize(capacity);
+  reset();
+}
+
+/**************************************************************************/
+/*!
+    @brief  Power-cycle the module: drop buffers, line state and counters but
+            keep the template library and system parameters
+*/
+/**************************************************************************/
+void R301T_Simulator::reset(void) {
+  commandsHandled = 0;
+  bytesIn = 0;
+  bytesOut = 0;
+  framesIn = 0;
+  framesOut = 0;
+  fingerPresent = false;
+  imageValid = false;
+  charBuffer[0].clear();
+  charBuffer[1].clear();
+  frame.clear();
+  frameLength = 0;
+  downloadBuffer = 0;
+  downloadData.clear();
+  rxLineFree = txLineFree = frameArrival = nativeMicros64();
+  outgoing.clear();
+  noiseBytes = 0;
+  noiseStartCode = false;
+  corruptOffset = R301T_NOCORRUPTION;
+  corruptSkip = 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Host opened (or reopened) its UART. Bytes only get through when
+            both ends agree on the rate.
+    @param  baud Host side baud rate
+*/
+/**************************************************************************/
+void R301T_Simulator::begin(unsigned long baud) {
+  hostBaud = baud;
+}
+
+int R301T_Simulator::available(void) {
+  uint64_t now = nativeMicros64();
+  int n = 0;
+  for (std::deque<Pending>::const_iterator it = outgoing.begin();
+       it != outgoing.end() && it->due <= now; ++it)
+    n++;
+  return n;
+}
+
+int R301T_Simulator::read(void) {
+  if (outgoing.empty() || outgoing.front().due > nativeMicros64())
+    return -1;
+  uint8_t c = outgoing.front().value;
+  if (outgoing.front().baud != hostBaud)
+    c ^= 0x5A;  // sampled at the wrong rate
+  outgoing.pop_front();
+  bytesOut++;
+  return c;
+}
+
+int R301T_Simulator::peek(void) {
+  if (outgoing.empty() || outgoing.front().due > nativeMicros64())
+    return -1;
+  uint8_t c = outgoing.front().value;
+  return outgoing.front().baud == hostBaud ? c : c ^ 0x5A;
+}
+
+size_t R301T_Simulator::write(uint8_t c) {
+  uint64_t now = nativeMicros64();
+  if (rxLineFree < now) rxLineFree = now;
+  rxLineFree += byteTime();
+  bytesIn++;
+  receive(c);
+  return 1;
+}
+
+size_t R301T_Simulator::write(const uint8_t *buffer, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    write(buffer[i]);
+  return size;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Put a finger on the window; the next GETIMAGE succeeds and
+            IMAGE2TZ produces these features
+    @param  features R301T_TEMPLATE_SIZE bytes
+*/
+/**************************************************************************/
+void R301T_Simulator::placeFinger(const uint8_t *features) {
+  finger.assign(features, features + R301T_TEMPLATE_SIZE);
+  fingerPresent = true;
+}
+
+void R301T_Simulator::liftFinger(void) {
+  fingerPresent = false;
+}
+
+void R301T_Simulator::setTemplate(uint16_t page, const uint8_t *features) {
+  if (page >= libraryCapacity) return;
+  if (features)
+    library[page].assign(features, features + R301T_TEMPLATE_SIZE);
+  else
+    library[page].clear();
+}
+
+const uint8_t *R301T_Simulator::getTemplate(uint16_t page) const {
+  if (!occupied(page)) return NULL;
+  return &library[page][0];
+}
+
+void R301T_Simulator::clearLibrary(void) {
+  for (uint16_t i = 0; i < libraryCapacity; i++)
+    library[i].clear();
+}
+
+bool R301T_Simulator::occupied(uint16_t page) const {
+  return page < libraryCapacity && !library[page].empty();
+}
+
+uint16_t R301T_Simulator::byteTime(void) const {
+  // start + 8 data + stop bits
+  return (uint16_t)(10000000UL / moduleBaud);
+}
+
+uint16_t R301T_Simulator::param16(uint16_t offset) const {
+  return ((uint16_t)frame[9 + offset] << 8) | frame[10 + offset];
+}
+
+void R301T_Simulator::receive(uint8_t c) {
+  if (hostBaud != moduleBaud) {
+    // framing errors on the module side, nothing decodes
+    frame.clear();
+    return;
+  }
+
+  if (frame.empty() && c != (FINGERPRINT_STARTCODE >> 8))
+    return;
+  if (frame.size() == 1 && c != (FINGERPRINT_STARTCODE & 0xFF)) {
+    frame.clear();
+    if (c == (FINGERPRINT_STARTCODE >> 8)) frame.push_back(c);
+    return;
+  }
+  frame.push_back(c);
+
+  if (frame.size() == 9)
+    frameLength = ((uint16_t)frame[7] << 8) | frame[8];
+  if (frame.size() >= 9 && frame.size() == 9u + frameLength) {
+    frameArrival = rxLineFree;
+    handleFrame();
+    frame.clear();
+  }
+}
+
+void R301T_Simulator::handleFrame(void) {
+  uint16_t sum = 0;
+  for (uint16_t i = 6; i < frame.size() - 2; i++)
+    sum += frame[i];
+  uint16_t expected = ((uint16_t)frame[frame.size() - 2] << 8) | frame[frame.size() - 1];
+  bool valid = frameLength >= 2 && sum == expected;
+  framesIn++;
+  // frames for other modules on the line are not ours to answer
+  if ((((uint32_t)frame[2] << 24) | ((uint32_t)frame[3] << 16) | ((uint32_t)frame[4] << 8) | frame[5]) != moduleAddress)
+    return;
+
+  switch (frame[6]) {
+    case FINGERPRINT_COMMANDPACKET:
+      commandsHandled++;
+      if (!valid || frameLength < 3)
+        reply(timing.command, FINGERPRINT_PACKETRECIEVEERR);
+      else
+        handleCommand();
+      break;
+    case FINGERPRINT_DATAPACKET:
+    case FINGERPRINT_ENDDATAPACKET:
+      if (valid)
+        handleData();
+      break;
+    default:
+      break;
+  }
+}
+
+void R301T_Simulator::handleCommand(void) {
+  uint8_t opcode = frame[9];
+  uint8_t payload[16];
+
+  switch (opcode) {
+    case FINGERPRINT_VERIFYPASSWORD: {
+      uint32_t pw = ((uint32_t)param16(1) << 16) | param16(3);
+      reply(timing.command, pw == password ? FINGERPRINT_OK : FINGERPRINT_PASSFAIL);
+      break;
+    }
+    case FINGERPRINT_SETPASSWORD:
+      password = ((uint32_t)param16(1) << 16) | param16(3);
+      reply(timing.command, FINGERPRINT_OK);
+      break;
+    case FINGERPRINT_SETADDRESS:
+      // acknowledged from the new address
+      moduleAddress = ((uint32_t)param16(1) << 16) | param16(3);
+      reply(timing.command, FINGERPRINT_OK);
+      break;
+    case FINGERPRINT_GETIMAGE:
+      imageValid = fingerPresent;
+      if (fingerPresent)
+        reply(timing.getImage, FINGERPRINT_OK);
+      else
+        reply(timing.noFinger, FINGERPRINT_NOFINGER);
+      break;
+    case FINGERPRINT_IMAGE2TZ: {
+      uint8_t buffer = frame[10];
+      if (buffer < 1 || buffer > 2) {
+        reply(timing.command, FINGERPRINT_PACKETRECIEVEERR);
+      } else if (!imageValid) {
+        reply(timing.image2Tz, FINGERPRINT_INVALIDIMAGE);
+      } else {
+        charBuffer[buffer - 1] = finger;
+        reply(timing.image2Tz, FINGERPRINT_OK);
+      }
+      break;
+    }
+    case FINGERPRINT_REGMODEL:
+      if (!charBuffer[0].empty() && charBuffer[0] == charBuffer[1])
+        reply(timing.image2Tz, FINGERPRINT_OK);
+      else
+        reply(timing.image2Tz, FINGERPRINT_ENROLLMISMATCH);
+      break;
+    case FINGERPRINT_STORE: {
+      uint8_t buffer = frame[10];
+      uint16_t page = param16(2);
+      if (buffer < 1 || buffer > 2 || page >= libraryCapacity) {
+        reply(timing.command, FINGERPRINT_BADLOCATION);
+      } else {
+        library[page] = charBuffer[buffer - 1];
+        library[page].resize(R301T_TEMPLATE_SIZE, 0);
+        reply(timing.store, FINGERPRINT_OK);
+      }
+      break;
+    }
+    case FINGERPRINT_LOAD: {
+      uint8_t buffer = frame[10];
+      uint16_t page = param16(2);
+      if (buffer < 1 || buffer > 2 || page >= libraryCapacity) {
+        reply(timing.command, FINGERPRINT_BADLOCATION);
+      } else if (!occupied(page)) {
+        reply(timing.load, FINGERPRINT_DBRANGEFAIL);
+      } else {
+        charBuffer[buffer - 1] = library[page];
+        reply(timing.load, FINGERPRINT_OK);
+      }
+      break;
+    }
+    case FINGERPRINT_UPLOAD: {
+      uint8_t buffer = frame[10];
+      if (buffer < 1 || buffer > 2 || charBuffer[buffer - 1].empty()) {
+        reply(timing.command, FINGERPRINT_UPLOADFEATUREFAIL);
+      } else {
+        reply(timing.transfer, FINGERPRINT_OK);
+        sendData(charBuffer[buffer - 1]);
+      }
+      break;
+    }
+    case FINGERPRINT_UPIMAGE:
+      if (!imageValid) {
+        reply(timing.command, FINGERPRINT_UPLOADFAIL);
+      } else {
+        std::vector<uint8_t> image(R301T_IMAGE_SIZE);
+        for (uint32_t i = 0; i < R301T_IMAGE_SIZE; i++)
+          image[i] = finger[i % R301T_TEMPLATE_SIZE] ^ (uint8_t)(i >> 9);
+        reply(timing.transfer, FINGERPRINT_OK);
+        sendData(image);
+      }
+      break;
+    case FINGERPRINT_DOWNLOAD: {
+      uint8_t buffer = frame[10];
+      if (buffer < 1 || buffer > 2) {
+        reply(timing.command, FINGERPRINT_PACKETRESPONSEFAIL);
+      } else {
+        downloadBuffer = buffer;
+        downloadData.clear();
+        reply(timing.transfer, FINGERPRINT_OK);
+      }
+      break;
+    }
+    case FINGERPRINT_DELETE: {
+      uint16_t page = param16(1), count = param16(3);
+      if ((uint32_t)page + count > libraryCapacity) {
+        reply(timing.command, FINGERPRINT_DELETEFAIL);
+      } else {
+        for (uint16_t i = 0; i < count; i++)
+          library[page + i].clear();
+        reply(timing.erase, FINGERPRINT_OK);
+      }
+      break;
+    }
+    case FINGERPRINT_EMPTY:
+      clearLibrary();
+      reply(timing.erase, FINGERPRINT_OK);
+      break;
+    case FINGERPRINT_MATCH:
+      if (!charBuffer[0].empty() && charBuffer[0] == charBuffer[1]) {
+        payload[0] = R301T_MATCHSCORE >> 8; payload[1] = R301T_MATCHSCORE & 0xFF;
+        reply(timing.match, FINGERPRINT_OK, payload, 2);
+      } else {
+        payload[0] = payload[1] = 0;
+        reply(timing.match, FINGERPRINT_NOMATCH, payload, 2);
+      }
+      break;
+    case FINGERPRINT_HISPEEDSEARCH: {
+      uint8_t buffer = frame[10];
+      uint16_t start = param16(2), count = param16(4);
+      uint32_t end = (uint32_t)start + count;
+      if (end > libraryCapacity) end = libraryCapacity;
+      if (buffer < 1 || buffer > 2) {
+        reply(timing.command, FINGERPRINT_PACKETRECIEVEERR);
+        break;
+      }
+      search(charBuffer[buffer - 1], start, end, 0);
+      break;
+    }
+    case FINGERPRINT_IDENTIFY:
+      // GetImage, Img2Tz into buffer 1 and a search of the whole library in one
+      if (identifySilent) {
+        break;
+      } else if (!autoIdentify) {
+        reply(timing.command, FINGERPRINT_PACKETRECIEVEERR);
+      } else if (!fingerPresent) {
+        imageValid = false;
+        reply(timing.noFinger, FINGERPRINT_NOFINGER);
+      } else {
+        imageValid = true;
+        charBuffer[0] = finger;
+        search(charBuffer[0], 0, libraryCapacity, timing.getImage + timing.image2Tz);
+      }
+      break;
+    case FINGERPRINT_SETSYSPARA: {
+      uint8_t reg = frame[10], value = frame[11];
+      if (reg == FINGERPRINT_BAUD_REG_ADDR && value >= 1 && value <= 12) {
+        // acknowledged at the old rate, then the UART switches
+        reply(timing.command, FINGERPRINT_OK);
+        moduleBaud = (uint32_t)value * FINGERPRINT_BAUDRATE_STEP;
+      } else if (reg == FINGERPRINT_SECURITY_REG_ADDR && value >= 1 && value <= 5) {
+        securityLevel = value;
+        reply(timing.command, FINGERPRINT_OK);
+      } else if (reg == FINGERPRINT_PACKET_REG_ADDR && value <= 3) {
+        dataPacketSize = FINGERPRINT_MINPACKETSIZE << value;
+        reply(timing.command, FINGERPRINT_OK);
+      } else {
+        reply(timing.command, FINGERPRINT_INVALIDREG);
+      }
+      break;
+    }
+    case FINGERPRINT_READSYSPARA: {
+      uint8_t code = 0;
+      while ((FINGERPRINT_MINPACKETSIZE << code) < dataPacketSize) code++;
+      memset(payload, 0, sizeof(payload));
+      payload[3] = 0x09;                      // system identifier code
+      payload[4] = libraryCapacity >> 8; payload[5] = libraryCapacity & 0xFF;
+      payload[7] = securityLevel;
+      payload[8] = moduleAddress >> 24; payload[9] = moduleAddress >> 16;
+      payload[10] = moduleAddress >> 8; payload[11] = moduleAddress & 0xFF;
+      payload[13] = code;
+      payload[15] = moduleBaud / FINGERPRINT_BAUDRATE_STEP;
+      reply(timing.command, FINGERPRINT_OK, payload, 16);
+      break;
+    }
+    case FINGERPRINT_TEMPLATECOUNT: {
+      uint16_t count = 0;
+      for (uint16_t i = 0; i < libraryCapacity; i++)
+        if (occupied(i)) count++;
+      payload[0] = count >> 8; payload[1] = count & 0xFF;
+      reply(timing.command, FINGERPRINT_OK, payload, 2);
+      break;
+    }
+    case FINGERPRINT_READINDEX: {
+      uint8_t table = frame[10];
+      if (!indexTable) {
+        reply(timing.command, FINGERPRINT_PACKETRECIEVEERR);
+      } else if (table > 3) {
+        reply(timing.command, FINGERPRINT_BADLOCATION);
+      } else {
+        uint8_t bitmap[FINGERPRINT_INDEXTABLESIZE] = { 0 };
+        for (uint16_t i = 0; i < FINGERPRINT_INDEXTABLESIZE * 8; i++) {
+          uint16_t page = table * FINGERPRINT_INDEXTABLESIZE * 8 + i;
+          if (page < libraryCapacity && occupied(page))
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+        reply(timing.command, FINGERPRINT_OK, bitmap, sizeof(bitmap));
+      }
+      break;
+    }
+    default:
+      reply(timing.command, FINGERPRINT_PACKETRECIEVEERR);
+      break;
+  }
+}
+
+void R301T_Simulator::handleData(void) {
+  if (!downloadBuffer) return;
+
+  downloadData.insert(downloadData.end(), frame.begin() + 9, frame.end() - 2);
+  if (frame[6] == FINGERPRINT_ENDDATAPACKET) {
+    downloadData.resize(R301T_TEMPLATE_SIZE, 0);
+    charBuffer[downloadBuffer - 1] = downloadData;
+    downloadBuffer = 0;
+  }
+}
+
+// Scan pages start..end-1 up to the first match, replying as HISPEEDSEARCH does
+void R301T_Simulator::search(const std::vector<uint8_t> &features, uint32_t start, uint32_t end, uint32_t latency) {
+  uint8_t payload[4] = { 0 };
+  uint32_t scanned = 0;
+  for (uint32_t page = start; page < end; page++) {
+    scanned++;
+    if (occupied(page) && library[page] == features) {
+      payload[0] = page >> 8; payload[1] = page & 0xFF;
+      payload[2] = R301T_MATCHSCORE >> 8; payload[3] = R301T_MATCHSCORE & 0xFF;
+      latency += timing.searchBase + timing.searchPerPage * scanned;
+      reply(latency, FINGERPRINT_OK, payload, sizeof(payload));
+      return;
+    }
+  }
+  latency += timing.searchBase + timing.searchPerPage * scanned;
+  reply(latency, FINGERPRINT_NOTFOUND, payload, sizeof(payload));
+}
+
+void R301T_Simulator::reply(uint32_t latency, uint8_t code, const uint8_t *extra, uint16_t extraLength) {
+  uint8_t payload[1 + 32];
+  payload[0] = code;
+  if (extraLength) memcpy(payload + 1, extra, extraLength);
+
+  uint64_t start = frameArrival + latency;
+  if (txLineFree < start) txLineFree = start;
+  queueFrame(FINGERPRINT_ACKPACKET, payload, 1 + extraLength);
+}
+
+void R301T_Simulator::sendData(const std::vector<uint8_t> &data) {
+  for (uint32_t offset = 0; offset < data.size(); offset += dataPacketSize) {
+    uint16_t chunk = data.size() - offset > dataPacketSize ? dataPacketSize : data.size() - offset;
+    bool last = offset + chunk >= data.size();
+    queueFrame(last ? FINGERPRINT_ENDDATAPACKET : FINGERPRINT_DATAPACKET, &data[offset], chunk);
+  }
+}
+
+void R301T_Simulator::queueFrame(uint8_t type, const uint8_t *payload, uint16_t length) {
+  uint16_t wire_length = length + 2;
+  uint16_t sum = (wire_length >> 8) + (wire_length & 0xFF) + type;
+  uint8_t header[9] = { FINGERPRINT_STARTCODE >> 8, FINGERPRINT_STARTCODE & 0xFF,
+                        (uint8_t)(moduleAddress >> 24), (uint8_t)(moduleAddress >> 16),
+                        (uint8_t)(moduleAddress >> 8), (uint8_t)(moduleAddress & 0xFF), type,
+                        (uint8_t)(wire_length >> 8), (uint8_t)(wire_length & 0xFF) };
+
+  uint64_t now = nativeMicros64();
+  if (txLineFree < now) txLineFree = now;
+
+  // line noise ahead of the frame, including a false start byte
+  for (; noiseBytes; noiseBytes--)
+    queueByte(noiseBytes & 1 ? FINGERPRINT_STARTCODE >> 8 : 0x55);
+  if (noiseStartCode) {
+    queueByte(FINGERPRINT_STARTCODE >> 8);
+    queueByte(FINGERPRINT_STARTCODE & 0xFF);
+    noiseStartCode = false;
+  }
+
+  uint16_t offset = 0;
+  for (uint8_t i = 0; i < sizeof(header); i++)
+    queueByte(header[i], offset++);
+  for (uint16_t i = 0; i < length; i++) {
+    sum += payload[i];
+    queueByte(payload[i], offset++);
+  }
+  queueByte(sum >> 8, offset++);
+  queueByte(sum & 0xFF, offset++);
+  framesOut++;
+  if (corruptSkip)
+    corruptSkip--;
+  else
+    corruptOffset = R301T_NOCORRUPTION;
+}
+
+void R301T_Simulator::queueByte(uint8_t value, uint16_t offset) {
+  Pending p;
+  txLineFree += byteTime();
+  p.due = txLineFree;
+  p.baud = moduleBaud;
+  bool damage = offset != R301T_NOCORRUPTION && offset == corruptOffset && !corruptSkip;
+  p.value = damage ? value ^ 0x10 : value;
+  outgoing.push_back(p);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Send a few garbage bytes ahead of the next frame
+    @param  bytes How many
+    @param  startCode End the garbage with a whole false start code, EF 01
+*/
+/**************************************************************************/
+void R301T_Simulator::injectNoise(uint8_t bytes, bool startCode) {
+  noiseBytes = bytes;
+  noiseStartCode = startCode;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Flip a bit in one byte of the next frame sent to the host
+    @param  offset Byte position in the frame, 0 being the first start code byte
+    @param  skip Frames to send intact first, e.g. 1 to hit the first data packet after an ACK
+*/
+/**************************************************************************/
+void R301T_Simulator::corruptNextFrame(uint16_t offset, uint8_t skip) {
+  corruptOffset = offset;
+  corruptSkip = skip;
+}
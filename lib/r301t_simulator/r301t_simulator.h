@@ -0,0 +1,143 @@
+#ifndef R301T_SIMULATOR_H
+#define R301T_SIMULATOR_H
+
+/***************************************************
+  In-process model of an R301T/R30x fingerprint module for the `native`
+  environment. It sits behind the same Stream interface the library reads
+  and writes (mySerial), decodes the command frames it is sent and answers
+  them with protocol-correct ACK and data packets.
+
+  Timing follows the wire and the module: every byte costs 10 bit times at
+  the configured baud rate in each direction, and each command adds a
+  processing latency from R301T_Timing before its reply starts. All times
+  are on the virtual clock of the native Arduino shim.
+ ****************************************************/
+
+#include "Arduino.h"
+#include <custom_adafruit_fingerprint.h>
+
+#include <deque>
+#include <vector>
+
+#define R301T_TEMPLATE_SIZE 512   ///< Bytes in one character file / template
+#define R301T_IMAGE_SIZE 36864    ///< 256x288 pixels, 4 bits each, as sent by UPIMAGE
+#define R301T_NOCORRUPTION 0xFFFF ///< corruptNextFrame() offset that leaves frames intact
+
+///! Per-command processing latencies of the simulated module, in microseconds
+struct R301T_Timing {
+  uint32_t getImage;          ///< GETIMAGE with a finger on the window
+  uint32_t noFinger;          ///< GETIMAGE that finds no finger
+  uint32_t image2Tz;          ///< Feature extraction
+  uint32_t searchBase;        ///< Fixed part of HISPEEDSEARCH
+  uint32_t searchPerPage;     ///< Added for every page in the searched range
+  uint32_t match;             ///< 1:1 MATCH of the two char buffers
+  uint32_t load;              ///< LOAD from flash into a char buffer
+  uint32_t store;             ///< STORE (flash write)
+  uint32_t erase;             ///< DELETE / EMPTY
+  uint32_t transfer;          ///< Turnaround before UPLOAD/DOWNLOAD data
+  uint32_t command;           ///< Any other command
+};
+
+///! Simulated sensor, usable wherever the library expects a HardwareSerial
+class R301T_Simulator : public HardwareSerial {
+ public:
+  R301T_Simulator(uint16_t capacity = 1000, uint32_t baudrate = 57600);
+
+  // Host side of the UART
+  void begin(unsigned long baud);
+  int available(void);
+  int read(void);
+  int peek(void);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+  // Sensor model
+  void placeFinger(const uint8_t *features);
+  void liftFinger(void);
+  void setTemplate(uint16_t page, const uint8_t *features);
+  const uint8_t *getTemplate(uint16_t page) const;
+  void clearLibrary(void);
+  void reset(void);
+
+  uint16_t capacity(void) const { return libraryCapacity; }
+  uint32_t baudRate(void) const { return moduleBaud; }
+  uint32_t address(void) const { return moduleAddress; }
+  uint16_t packetSize(void) const { return dataPacketSize; }
+  void setPacketSize(uint16_t bytes) { dataPacketSize = bytes; }
+
+  // Line faults, applied to the next frame the module sends
+  void injectNoise(uint8_t bytes, bool startCode = false);
+  void corruptNextFrame(uint16_t offset, uint8_t skip = 0);
+
+  /// Latencies applied to each command, see R301T_Timing
+  R301T_Timing timing;
+  /// Answer ReadIndexTable; older firmware rejects it like any unknown command
+  bool indexTable;
+  /// Answer the one-shot Identify command; older firmware rejects it
+  bool autoIdentify;
+  /// Ignore the Identify command altogether, sending no reply, as some firmware does
+  bool identifySilent;
+  /// Command frames decoded since construction
+  uint32_t commandsHandled;
+  /// Bytes received from the host since construction
+  uint32_t bytesIn;
+  /// Bytes sent to the host since construction
+  uint32_t bytesOut;
+  /// Frames of any type received from the host since construction
+  uint32_t framesIn;
+  /// Frames of any type sent to the host since construction
+  uint32_t framesOut;
+
+ private:
+  struct Pending {
+    uint64_t due;
+    uint32_t baud;            ///< Module rate the byte was sent at
+    uint8_t value;
+  };
+
+  void receive(uint8_t c);
+  void handleFrame(void);
+  void handleCommand(void);
+  void handleData(void);
+  void search(const std::vector<uint8_t> &features, uint32_t start, uint32_t end, uint32_t latency);
+  void reply(uint32_t latency, uint8_t code, const uint8_t *extra = NULL, uint16_t extraLength = 0);
+  void queueFrame(uint8_t type, const uint8_t *payload, uint16_t length);
+  void queueByte(uint8_t value, uint16_t offset = R301T_NOCORRUPTION);
+  void sendData(const std::vector<uint8_t> &data);
+  uint16_t byteTime(void) const;
+  bool occupied(uint16_t page) const;
+  uint16_t param16(uint16_t offset) const;
+
+  uint16_t libraryCapacity;
+  uint32_t moduleBaud;
+  uint32_t hostBaud;
+  uint16_t dataPacketSize;
+  uint32_t password;
+  uint32_t moduleAddress;     ///< Frames with any other address are ignored
+  uint8_t securityLevel;
+
+  bool fingerPresent;
+  bool imageValid;
+  std::vector<uint8_t> finger;
+  std::vector<uint8_t> charBuffer[2];
+  std::vector<std::vector<uint8_t> > library;
+
+  // Incoming frame decoder
+  std::vector<uint8_t> frame;
+  uint16_t frameLength;
+  uint8_t downloadBuffer;     ///< Char buffer being filled by DOWNLOAD, 0 when idle
+  std::vector<uint8_t> downloadData;
+
+  // Wire model
+  uint64_t rxLineFree;        ///< When the host->sensor line finishes its last byte
+  uint64_t txLineFree;        ///< When the sensor->host line finishes its last byte
+  uint64_t frameArrival;      ///< Arrival time of the last byte of the current frame
+  std::deque<Pending> outgoing;
+  uint8_t noiseBytes;         ///< Garbage to send before the next frame
+  bool noiseStartCode;        ///< End that garbage with a false EF 01
+  uint16_t corruptOffset;     ///< Byte of the next frame to damage
+  uint8_t corruptSkip;        ///< Frames to send intact before that
+};
+
+#endif
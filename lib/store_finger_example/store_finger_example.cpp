@@ -379,46 +379,47 @@ uint8_t Adafruit_Fingerprint::setPassword(uint32_t password) {
 /**************************************************************************/
 
 void Adafruit_Fingerprint::writeStructuredPacket(const Adafruit_Fingerprint_Packet & packet) {
-  SERIAL_WRITE_U16(packet.start_code);
-  SERIAL_WRITE(packet.address[0]);
-  SERIAL_WRITE(packet.address[1]);
-  SERIAL_WRITE(packet.address[2]);
-  SERIAL_WRITE(packet.address[3]);
-  SERIAL_WRITE(packet.type);
-
-  uint16_t wire_length = packet.length + 2;
-  SERIAL_WRITE_U16(wire_length);
+  uint8_t frame[9 + sizeof(packet.data) + 2];
+  // the constructor keeps any length but copies at most sizeof(data) bytes
+  uint16_t length = packet.length < sizeof(packet.data) ? packet.length : sizeof(packet.data);
+  uint16_t wire_length = length + 2;
+  uint8_t n = 0;
+
+  frame[n++] = (uint8_t)(packet.start_code >> 8);
+  frame[n++] = (uint8_t)(packet.start_code & 0xFF);
+  for (uint8_t i=0; i<4; i++)
+    frame[n++] = packet.address[i];
+  frame[n++] = packet.type;
+  frame[n++] = (uint8_t)(wire_length >> 8);
+  frame[n++] = (uint8_t)(wire_length & 0xFF);
 
   uint16_t sum = ((wire_length)>>8) + ((wire_length)&0xFF) + packet.type;
-  for (uint8_t i=0; i< packet.length; i++) {
-    SERIAL_WRITE(packet.data[i]);
+  for (uint16_t i=0; i< length; i++) {
+    frame[n++] = packet.data[i];
     sum += packet.data[i];
   }
+  frame[n++] = (uint8_t)(sum >> 8);
+  frame[n++] = (uint8_t)(sum & 0xFF);
 
-  SERIAL_WRITE_U16(sum);
-  return;
+  mySerial->write(frame, n);
 }
 
 //------------------------------------------------------------------------------------------
 //writePacket(theAddress, FINGERPRINT_COMMANDPACKET, sizeof(packet), packet);
 void Adafruit_Fingerprint::writePacket(uint32_t addr, uint8_t packettype, uint16_t len, uint8_t *packet) {
-  mySerial->write((uint8_t)(FINGERPRINT_STARTCODE >> 8));
-  mySerial->write((uint8_t)FINGERPRINT_STARTCODE);
-  mySerial->write((uint8_t)(addr >> 24));
-  mySerial->write((uint8_t)(addr >> 16));
-  mySerial->write((uint8_t)(addr >> 8));
-  mySerial->write((uint8_t)(addr));
-  mySerial->write((uint8_t)packettype);
-  mySerial->write((uint8_t)(len >> 8));
-  mySerial->write((uint8_t)(len));
+  uint8_t header[] = { (uint8_t)(FINGERPRINT_STARTCODE >> 8), (uint8_t)FINGERPRINT_STARTCODE,
+                       (uint8_t)(addr >> 24), (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)(addr),
+                       (uint8_t)packettype, (uint8_t)(len >> 8), (uint8_t)(len) };
 
   uint16_t sum = (len>>8) + (len&0xFF) + packettype;
-  for (uint8_t i=0; i< len-2; i++) {
-    mySerial->write((uint8_t)(packet[i]));
+  for (uint16_t i=0; i< len-2; i++)
     sum += packet[i];
-  }
-  mySerial->write((uint8_t)(sum>>8));
-  mySerial->write((uint8_t)sum);
+  uint8_t checksum[] = { (uint8_t)(sum>>8), (uint8_t)sum };
+
+  // header, payload and checksum as three bulk writes rather than one call per byte
+  mySerial->write(header, sizeof(header));
+  mySerial->write(packet, len-2);
+  mySerial->write(checksum, sizeof(checksum));
 }
 //------------------------------------------------------------------------------------------
 
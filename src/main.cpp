@@ -27,7 +27,8 @@
 // void setup()  
 // {
 //   while(!Serial);
-//   Serial.begin(9600);
+//   // faster than the sensor's 57600, so the backup below keeps up with it
+//   Serial.begin(115200);
 //   Serial.println("Fingerprint template extractor");
 
 //   // set the data rate for the sensor serial port
@@ -44,6 +45,10 @@
 //   for (int finger = 1; finger < 10; finger++) {
 //     downloadFingerprintTemplate(finger);
 //   }
+
+//   // Or back up the whole library in binary, to be picked up with
+//   // tools/backup_receive.py /dev/ttyUSB0 -b 115200 -o backup/
+//   // finger.exportLibrary(Serial);
 // }
 
 // uint8_t downloadFingerprintTemplate(uint16_t id)
@@ -66,51 +71,23 @@
 //   // OK success!
 
 //   Serial.print("Attempting to get #"); Serial.println(id);
-//   p = finger.getModel();
+//   uint8_t fingerTemplate[FINGERPRINT_TEMPLATESIZE]; // the real template, filled as packets arrive
+//   p = finger.uploadModel(fingerTemplate, sizeof(fingerTemplate));
 //   switch (p) {
 //     case FINGERPRINT_OK:
-//       Serial.print("Template "); Serial.print(id); Serial.println(" transferring:");
+//       Serial.print("Template "); Serial.print(id); Serial.println(" transferred");
 //       break;
 //    default:
 //       Serial.print("Unknown error "); Serial.println(p);
 //       return p;
 //   }
-  
-//   // one data packet is 267 bytes. in one data packet, 11 bytes are 'usesless' :D
-//   uint8_t bytesReceived[534]; // 2 data packets
-//   memset(bytesReceived, 0xff, 534);
-
-//   uint32_t starttime = millis();
-//   int i = 0;
-//   while (i < 534 && (millis() - starttime) < 20000) {
-//       if (mySerial.available()) {
-//           bytesReceived[i++] = mySerial.read();
-//       }
-//   }
-//   Serial.print(i); Serial.println(" bytes read.");
-//   Serial.println("Decoding packet...");
-
-//   uint8_t fingerTemplate[512]; // the real template
-//   memset(fingerTemplate, 0xff, 512);
-
-//   // filtering only the data packets
-//   int uindx = 9, index = 0;
-//   while (index < 534) {
-//       while (index < uindx) ++index;
-//       uindx += 256;
-//       while (index < uindx) {
-//           fingerTemplate[index++] = bytesReceived[index];
-//       }
-//       uindx += 2;
-//       while (index < uindx) ++index;
-//       uindx = index + 9;
-//   }
+//   Serial.print(finger.transferLength); Serial.println(" bytes read.");
+//   // two-digit hex, 16 bytes a line, as tools/template_bank_gen.py reads it
 //   for (int i = 0; i < 512; ++i) {
-//       // Serial.print("0x");
-//       Serial.print(fingerTemplate[i]);
-//       // Serial.print(", ");
+//       if (fingerTemplate[i] < 0x10) Serial.print('0');
+//       Serial.print(fingerTemplate[i], HEX);
+//       Serial.print(i % 16 == 15 ? '\n' : ' ');
 //   }
-//   Serial.println();
 //   Serial.println("\ndone.");
 
 //   /*
@@ -183,6 +160,16 @@
 
 // Adafruit_Fingerprint finger = Adafruit_Fingerprint(&mySerial);
 
+// // templates exported from another sensor (see the extractor sketch above),
+// // kept in flash so any number of them fit
+// const uint8_t masterTemplate[FINGERPRINT_TEMPLATESIZE] PROGMEM = { /* ... */ };
+// const uint8_t maintenanceTemplate[FINGERPRINT_TEMPLATESIZE] PROGMEM = { /* ... */ };
+
+// const Adafruit_Fingerprint_Template templateBank[] PROGMEM = {
+//   { 5, masterTemplate, sizeof(masterTemplate), FINGERPRINT_TEMPLATE_RAW },
+//   { 6, maintenanceTemplate, sizeof(maintenanceTemplate), FINGERPRINT_TEMPLATE_RAW },
+// };
+
 // void setup()  
 // {
 //   Serial.begin(9600);
@@ -213,8 +200,8 @@
 
 //   Serial.println("Now database is empty :)");
 
-//   finger.uploadModel();
-//   finger.storeModel(5);
+//   if (finger.storeTemplateBank(templateBank, sizeof(templateBank) / sizeof(templateBank[0])) == FINGERPRINT_OK)
+//     Serial.println("Stored the template bank");
 // }
 
 // void loop() {
@@ -238,16 +225,18 @@
 
 
 #include <custom_adafruit_fingerprint.h>
+#include <fingerprint_transport.h>
 
-// On Leonardo/Micro or others with hardware serial, use those! #0 is green wire, #1 is white
-// uncomment this line:
-// #define mySerial Serial1
-
+#if defined(FINGERPRINT_USART) && FINGERPRINT_USART == 1
+// On Mega/Leonardo/Micro the second USART is free, and driven by interrupts
+// RX1 is IN from sensor (GREEN wire), TX1 is OUT from arduino (WHITE wire)
+Adafruit_Fingerprint_Usart mySerial;
+#else
 // For UNO and others without hardware serial, we must use software serial...
 // pin #2 is IN from sensor (GREEN wire)
 // pin #3 is OUT from arduino  (WHITE wire)
-// comment these two lines if using hardware serial
 SoftwareSerial mySerial(2, 3);
+#endif
 
 Adafruit_Fingerprint finger = Adafruit_Fingerprint(&mySerial);
 
@@ -350,13 +339,8 @@ uint8_t getFingerprintID() {
 
 // returns -1 if failed, otherwise returns ID #
 int getFingerprintIDez() {
-  uint8_t p = finger.getImage();
-  if (p != FINGERPRINT_OK)  return -1;
-
-  p = finger.image2Tz();
-  if (p != FINGERPRINT_OK)  return -1;
-
-  p = finger.fingerFastSearch();
+  // getImage(), image2Tz() and fingerFastSearch() in one round trip
+  uint8_t p = finger.identify();
   if (p != FINGERPRINT_OK)  return -1;
   
   // found a match!
@@ -0,0 +1,744 @@
+/***************************************************
+  Protocol benchmark for the `native` environment.
+
+  Drives Adafruit_Fingerprint against the simulated R301T module and
+  reports, per operation, the simulated wire time (virtual clock), the
+  resulting commands/sec, time per frame on the wire and UART bytes/sec,
+  and the host CPU time spent in the library. Each benchmark carries a
+  latency budget; the program exits non-zero when an operation fails or a
+  budget is exceeded, so CI catches protocol latency regressions. The
+  line fault and error path regressions are Unity suites under test/
+  (`pio test -e native`). The last cases run in real time over a
+  pseudo-terminal through the termios transport, with the simulated
+  module on the master side.
+
+    pio run -e native && .pio/build/native/program
+ ****************************************************/
+
+#include <Arduino.h>
+#include <custom_adafruit_fingerprint.h>
+#include <r301t_simulator.h>
+#include <fingerprint_transport.h>
+
+#include <chrono>
+#include <vector>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define BENCH_CAPACITY 1000
+#define BENCH_BAUD 57600
+#define BENCH_MATCHPAGE 100
+#define BENCH_HIGHPAGE 901      ///< Beyond the 163 pages a fixed-range search covers
+#define BENCH_HOTPAGES 16
+#define BENCH_HOTFIRST (BENCH_CAPACITY - BENCH_HOTPAGES)
+#define BENCH_EXITADDRESS 0x0000E817  ///< Where setAddress() moves the exit reader
+
+static R301T_Simulator sensor(BENCH_CAPACITY, BENCH_BAUD);
+static Adafruit_Fingerprint finger = Adafruit_Fingerprint(&sensor);
+// the other reader of a door pair, on a UART of its own
+static R301T_Simulator exitSensor(BENCH_CAPACITY, BENCH_BAUD);
+static Adafruit_Fingerprint exitFinger = Adafruit_Fingerprint(&exitSensor);
+
+static uint8_t features[R301T_TEMPLATE_SIZE];
+
+///! One timed operation, repeated `iterations` times
+struct Benchmark {
+  const char *name;
+  uint16_t iterations;
+  uint32_t budget;            ///< Max average simulated microseconds per operation
+  bool (*setup)(void);
+  bool (*run)(void);
+};
+
+static void makeFeatures(uint8_t *buffer, uint16_t seed) {
+  for (uint16_t i = 0; i < R301T_TEMPLATE_SIZE; i++)
+    buffer[i] = (uint8_t)(seed * 31 + i * 7);
+}
+
+static bool noSetup(void) { return true; }
+
+static bool fingerOn(void) {
+  sensor.placeFinger(features);
+  return true;
+}
+
+static bool fingerOff(void) {
+  sensor.liftFinger();
+  return true;
+}
+
+static bool runVerifyPassword(void) {
+  return finger.verifyPassword();
+}
+
+static bool runTemplateCount(void) {
+  return finger.getTemplateCount() == FINGERPRINT_OK;
+}
+
+static bool runStructuredRoundTrip(void) {
+  uint8_t data[] = { FINGERPRINT_TEMPLATECOUNT };
+  Adafruit_Fingerprint_SizedPacket<sizeof(data)> command(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+  Adafruit_Fingerprint_SizedPacket<3> ack;
+  finger.writeStructuredPacket(command);
+  if (finger.getStructuredPacket(&ack) != FINGERPRINT_OK) return false;
+  return ack.type == FINGERPRINT_ACKPACKET && ack.length == 3 && ack.data[0] == FINGERPRINT_OK;
+}
+
+static bool runStructuredDownload(void) {
+  // whole 128-byte data frames built as packets rather than streamed
+  uint8_t data[] = { FINGERPRINT_DOWNLOAD, 0x01 };
+  Adafruit_Fingerprint_SizedPacket<sizeof(data)> command(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+  Adafruit_Fingerprint_SizedPacket<1> ack;
+  finger.writeStructuredPacket(command);
+  if (finger.getStructuredPacket(&ack) != FINGERPRINT_OK || ack.data[0] != FINGERPRINT_OK) return false;
+
+  for (uint16_t offset = 0; offset < sizeof(features); offset += FINGERPRINT_DEFAULTPACKETSIZE) {
+    bool last = offset + FINGERPRINT_DEFAULTPACKETSIZE >= (uint16_t)sizeof(features);
+    Adafruit_Fingerprint_SizedPacket<FINGERPRINT_DEFAULTPACKETSIZE> frame(
+      last ? FINGERPRINT_ENDDATAPACKET : FINGERPRINT_DATAPACKET, FINGERPRINT_DEFAULTPACKETSIZE, features + offset);
+    finger.writeStructuredPacket(frame);
+  }
+  if (finger.storeModel(BENCH_MATCHPAGE + 4) != FINGERPRINT_OK) return false;
+  const uint8_t *stored = sensor.getTemplate(BENCH_MATCHPAGE + 4);
+  return stored && memcmp(stored, features, sizeof(features)) == 0;
+}
+
+static bool runNoFinger(void) {
+  return finger.getImage() == FINGERPRINT_NOFINGER;
+}
+
+static bool runIdentify(void) {
+  if (finger.getImage() != FINGERPRINT_OK) return false;
+  if (finger.image2Tz() != FINGERPRINT_OK) return false;
+  if (finger.fingerFastSearch() != FINGERPRINT_OK) return false;
+  return finger.fingerID == BENCH_MATCHPAGE;
+}
+
+static bool runIdentifyOneCommand(void) {
+  if (finger.identify() != FINGERPRINT_OK) return false;
+  return finger.fingerID == BENCH_MATCHPAGE;
+}
+
+// a second driver, so the fallback is learned from scratch
+static Adafruit_Fingerprint legacy = Adafruit_Fingerprint(&sensor);
+
+static bool runIdentifyFallback(void) {
+  // firmware without Identify
+  sensor.autoIdentify = false;
+  bool ok = legacy.identify() == FINGERPRINT_OK && legacy.fingerID == BENCH_MATCHPAGE;
+  sensor.autoIdentify = true;
+  return ok;
+}
+
+static uint32_t loopPasses;
+
+static bool pollUntilDone(uint8_t started, uint8_t expected) {
+  if (started != FINGERPRINT_OK) return false;
+  uint8_t p;
+  // stands in for loop(): one poll() per pass, the rest of the pass is free
+  while ((p = finger.poll()) == FINGERPRINT_BUSY) {
+    loopPasses++;
+    delayMicroseconds(100);
+  }
+  return p == expected;
+}
+
+static bool runIdentifyAsync(void) {
+  if (!pollUntilDone(finger.beginGetImage(), FINGERPRINT_OK)) return false;
+  if (!pollUntilDone(finger.beginImage2Tz(), FINGERPRINT_OK)) return false;
+  if (!pollUntilDone(finger.beginSearch(), FINGERPRINT_OK)) return false;
+  return finger.fingerID == BENCH_MATCHPAGE && loopPasses > 0;
+}
+
+static bool runVerify(void) {
+  if (finger.verify(BENCH_MATCHPAGE) != FINGERPRINT_OK) return false;
+  return finger.fingerID == BENCH_MATCHPAGE && finger.confidence;
+}
+
+static bool runVerifyOther(void) {
+  // page 102 holds somebody else
+  return finger.verify(BENCH_MATCHPAGE + 2) == FINGERPRINT_NOMATCH && !finger.confidence;
+}
+
+static bool fingerScanned(void) {
+  sensor.placeFinger(features);
+  return finger.getImage() == FINGERPRINT_OK && finger.image2Tz() == FINGERPRINT_OK;
+}
+
+static bool runSearchPartition(void) {
+  // a partition of 16 pages around the enrolled finger
+  if (finger.search(BENCH_MATCHPAGE - 4, 16) != FINGERPRINT_OK) return false;
+  if (finger.fingerID != BENCH_MATCHPAGE) return false;
+  return finger.search(0, BENCH_MATCHPAGE) == FINGERPRINT_NOTFOUND;
+}
+
+static uint8_t highFeatures[R301T_TEMPLATE_SIZE];
+
+static bool highFingerScanned(void) {
+  makeFeatures(highFeatures, BENCH_HIGHPAGE);
+  highFeatures[0] ^= 0xFF;    // the seeded pattern repeats every 256 pages
+  sensor.setTemplate(BENCH_HIGHPAGE, highFeatures);
+  sensor.placeFinger(highFeatures);
+  return finger.getImage() == FINGERPRINT_OK && finger.image2Tz() == FINGERPRINT_OK;
+}
+
+static bool runSearchHighPage(void) {
+  // only found when the search covers the whole library
+  if (finger.fingerFastSearch() != FINGERPRINT_OK) return false;
+  return finger.fingerID == BENCH_HIGHPAGE;
+}
+
+static Adafruit_Fingerprint_HotSet<BENCH_HOTPAGES> hotSet;
+
+static bool hotSetPromoted(void) {
+  // a regular at page 901: one match out in the library, then promotion
+  if (hotSet.begin(finger, BENCH_HOTFIRST) != FINGERPRINT_OK) return false;
+  if (!highFingerScanned() || hotSet.search() != FINGERPRINT_OK) return false;
+  if (finger.fingerID != BENCH_HIGHPAGE || hotSet.isHot(BENCH_HIGHPAGE)) return false;
+  if (hotSet.maintain() != FINGERPRINT_OK) return false;
+  return hotSet.isHot(BENCH_HIGHPAGE) && sensor.getTemplate(BENCH_HOTFIRST);
+}
+
+static bool runHotSetHit(void) {
+  // maintain() must have left the scan in char buffer 1 alone
+  if (hotSet.search() != FINGERPRINT_OK) return false;
+  return finger.fingerID == BENCH_HIGHPAGE;
+}
+
+static bool runHotSetMiss(void) {
+  if (hotSet.search() != FINGERPRINT_OK) return false;
+  return finger.fingerID == BENCH_MATCHPAGE && !hotSet.isHot(BENCH_MATCHPAGE);
+}
+
+static bool runSetAddress(void) {
+  if (exitFinger.setAddress(BENCH_EXITADDRESS) != FINGERPRINT_OK) return false;
+  if (exitSensor.address() != BENCH_EXITADDRESS || !exitFinger.verifyPassword()) return false;
+  return exitFinger.setAddress(FINGERPRINT_DEFAULTADDRESS) == FINGERPRINT_OK;
+}
+
+static bool bothFingersOn(void) {
+  sensor.placeFinger(features);
+  exitSensor.placeFinger(features);
+  return exitFinger.setAddress(BENCH_EXITADDRESS) == FINGERPRINT_OK;
+}
+
+static bool manageUntilBoth(Adafruit_Fingerprint_Manager<2> &doors) {
+  bool reported[2] = { false, false };
+  uint64_t start = nativeMicros64();
+  while (!reported[0] || !reported[1]) {
+    if (nativeMicros64() - start > 2000000) return false;
+    uint8_t i = doors.poll();
+    if (i == FINGERPRINT_NOSENSOR) {
+      delayMicroseconds(100);
+      continue;
+    }
+    if (reported[i] || doors.result(i) != FINGERPRINT_OK || doors.fingerID(i) != BENCH_MATCHPAGE) return false;
+    reported[i] = true;
+  }
+  return true;
+}
+
+static bool runManager(void) {
+  // both readers touched at once: two identifications in the time of one
+  Adafruit_Fingerprint_Manager<2> doors;
+  if (doors.add(finger) != 0 || doors.add(exitFinger) != 1) return false;
+  bool ok = manageUntilBoth(doors);
+  // waits out the scans that look for the fingers being lifted
+  doors.stop();
+  return ok;
+}
+
+static bool runManagerHeld(void) {
+  // one report per touch, however long the finger stays
+  Adafruit_Fingerprint_Manager<2> doors;
+  doors.add(finger);
+  doors.add(exitFinger);
+  bool ok = manageUntilBoth(doors);
+  for (uint64_t end = nativeMicros64() + 500000; ok && nativeMicros64() < end; delayMicroseconds(100))
+    ok = doors.poll() == FINGERPRINT_NOSENSOR;
+  doors.stop();
+  return ok;
+}
+
+static bool runLoad(void) {
+  return finger.loadModel(BENCH_MATCHPAGE) == FINGERPRINT_OK;
+}
+
+static bool runStore(void) {
+  return finger.storeModel(BENCH_MATCHPAGE + 1) == FINGERPRINT_OK;
+}
+
+static uint16_t patternSource(uint8_t *buffer, uint16_t len, void *context) {
+  uint16_t *offset = (uint16_t *)context;
+  memcpy(buffer, features + *offset, len);
+  *offset += len;
+  return len;
+}
+
+static bool runStoreTemplate(void) {
+  if (finger.storeTemplate(BENCH_MATCHPAGE + 2, features) != FINGERPRINT_OK) return false;
+  const uint8_t *stored = sensor.getTemplate(BENCH_MATCHPAGE + 2);
+  return stored && memcmp(stored, features, sizeof(features)) == 0;
+}
+
+static bool runStoreTemplateSource(void) {
+  uint16_t offset = 0;
+  if (finger.storeTemplate(BENCH_MATCHPAGE + 3, patternSource, &offset) != FINGERPRINT_OK) return false;
+  const uint8_t *stored = sensor.getTemplate(BENCH_MATCHPAGE + 3);
+  return stored && memcmp(stored, features, sizeof(features)) == 0;
+}
+
+static bool runStoreBank(void) {
+  // PROGMEM is a no-op on the host, but the bank goes through the same pgm_read path
+  static const Adafruit_Fingerprint_Template bank[] PROGMEM = {
+    { BENCH_MATCHPAGE + 5, features, sizeof(features), FINGERPRINT_TEMPLATE_RAW },
+    { BENCH_MATCHPAGE + 6, features, sizeof(features), FINGERPRINT_TEMPLATE_RAW },
+  };
+  if (finger.storeTemplateBank(bank, sizeof(bank) / sizeof(bank[0])) != FINGERPRINT_OK) return false;
+  for (uint8_t i = 0; i < sizeof(bank) / sizeof(bank[0]); i++) {
+    const uint8_t *stored = sensor.getTemplate(bank[i].id);
+    if (!stored || memcmp(stored, features, sizeof(features)) != 0) return false;
+  }
+  return true;
+}
+
+static uint8_t runFeatures[R301T_TEMPLATE_SIZE];
+static uint8_t packedFeatures[R301T_TEMPLATE_SIZE + R301T_TEMPLATE_SIZE / 128 + 1];
+static uint16_t packedLength;
+
+static void makeRunFeatures(void) {
+  // mostly 0xEE/0xFF runs, like real exported templates
+  for (uint16_t i = 0; i < R301T_TEMPLATE_SIZE; i++)
+    runFeatures[i] = (i % 37 == 0) ? (uint8_t)i : ((i / 6) % 3 ? 0xEE : 0xFF);
+}
+
+static uint16_t rleEncode(const uint8_t *data, uint16_t length, uint8_t *out) {
+  // same coding as tools/template_bank_gen.py
+  uint16_t n = 0, literal = 0;
+  for (uint16_t i = 0; i < length; ) {
+    uint16_t run = 1;
+    while (i + run < length && data[i + run] == data[i] && run < 130) run++;
+    if (run >= 3 || literal == 128) {
+      if (literal) {
+        out[n - literal - 1] = literal - 1;
+        literal = 0;
+      }
+      if (run < 3) continue;
+      out[n++] = 0x80 | (run - 3);
+      out[n++] = data[i];
+      i += run;
+    } else {
+      if (!literal) n++;
+      out[n++] = data[i++];
+      literal++;
+    }
+  }
+  if (literal) out[n - literal - 1] = literal - 1;
+  return n;
+}
+
+static bool packRunFeatures(void) {
+  makeRunFeatures();
+  packedLength = rleEncode(runFeatures, sizeof(runFeatures), packedFeatures);
+  return packedLength < sizeof(runFeatures);
+}
+
+static bool runStoreRLE(void) {
+  if (finger.storeTemplateRLE_P(BENCH_MATCHPAGE + 7, packedFeatures) != FINGERPRINT_OK) return false;
+  const uint8_t *stored = sensor.getTemplate(BENCH_MATCHPAGE + 7);
+  return stored && memcmp(stored, runFeatures, sizeof(runFeatures)) == 0;
+}
+
+static void checksumSink(const uint8_t *data, uint16_t len, void *context) {
+  uint32_t *sum = (uint32_t *)context;
+  while (len--) *sum += *data++;
+}
+
+static bool runUploadModel(void) {
+  uint8_t buffer[FINGERPRINT_TEMPLATESIZE];
+  if (finger.loadModel(BENCH_MATCHPAGE) != FINGERPRINT_OK) return false;
+  if (finger.uploadModel(buffer, sizeof(buffer)) != FINGERPRINT_OK) return false;
+  return finger.transferLength == sizeof(buffer) && memcmp(buffer, features, sizeof(buffer)) == 0;
+}
+
+static bool uploadImageWith(Adafruit_Fingerprint &reader) {
+  uint32_t sum = 0;
+  if (reader.getImage() != FINGERPRINT_OK) return false;
+  if (reader.uploadImage(checksumSink, &sum) != FINGERPRINT_OK) return false;
+  return reader.transferLength == R301T_IMAGE_SIZE && sum != 0;
+}
+
+static bool runUploadImage(void) {
+  return uploadImageWith(finger);
+}
+
+// the same sensor through a driver bound to the simulator's class, so the
+// receive loops skip Stream's vtable; compare the host ns/op
+static Adafruit_Fingerprint_T<R301T_Simulator> bound(&sensor);
+
+static bool runUploadImageBound(void) {
+  return uploadImageWith(bound);
+}
+
+static bool runUploadModelBound(void) {
+  uint8_t buffer[FINGERPRINT_TEMPLATESIZE];
+  if (bound.loadModel(BENCH_MATCHPAGE) != FINGERPRINT_OK) return false;
+  if (bound.uploadModel(buffer, sizeof(buffer)) != FINGERPRINT_OK) return false;
+  return bound.transferLength == sizeof(buffer) && memcmp(buffer, features, sizeof(buffer)) == 0;
+}
+
+///! Host end of the backup link: keeps what it is sent
+class CaptureStream : public Print {
+ public:
+  size_t write(uint8_t c) { bytes.push_back(c); return 1; }
+  size_t write(const uint8_t *buffer, size_t size) {
+    bytes.insert(bytes.end(), buffer, buffer + size);
+    return size;
+  }
+  using Print::write;
+  std::vector<uint8_t> bytes;
+};
+
+static bool checkBackup(const std::vector<uint8_t> &stream, uint16_t *records) {
+  // the same parsing tools/backup_receive.py does
+  size_t i = 0;
+  *records = 0;
+  while (i + 3 <= stream.size() && stream[i] == FINGERPRINT_BACKUPMAGIC) {
+    uint16_t page = ((uint16_t)stream[i + 1] << 8) | stream[i + 2];
+    uint16_t sum = stream[i + 1] + stream[i + 2];
+    std::vector<uint8_t> data;
+    for (i += 3; i < stream.size() && stream[i]; i += 1 + stream[i]) {
+      data.insert(data.end(), &stream[i + 1], &stream[i + 1] + stream[i]);
+      for (uint8_t n = 0; n < stream[i]; n++) sum += stream[i + 1 + n];
+    }
+    if (i + 3 > stream.size()) return false;
+    if ((((uint16_t)stream[i + 1] << 8) | stream[i + 2]) != sum) return false;
+    i += 3;
+    if (page == FINGERPRINT_BACKUPEND) return i == stream.size();
+    const uint8_t *stored = sensor.getTemplate(page);
+    if (!stored || data.size() != R301T_TEMPLATE_SIZE || memcmp(stored, &data[0], data.size()) != 0)
+      return false;
+    (*records)++;
+  }
+  return false;
+}
+
+static bool runExportLibrary(void) {
+  CaptureStream host;
+  uint16_t records;
+  if (finger.exportLibrary(host) != FINGERPRINT_OK) return false;
+  if (!checkBackup(host.bytes, &records) || records != finger.templateCount) return false;
+  finger.getTemplateCount();
+  return records == finger.templateCount;
+}
+
+static bool runExportProbing(void) {
+  // firmware without ReadIndexTable: every page gets a LOAD
+  sensor.indexTable = false;
+  bool ok = runExportLibrary();
+  sensor.indexTable = true;
+  return ok;
+}
+
+static CaptureStream transcript;
+static Adafruit_Fingerprint_Recorder recorder(&sensor, &transcript);
+// a third driver, whose traffic is captured as on a door in the field
+static Adafruit_Fingerprint recorded = Adafruit_Fingerprint(&recorder);
+static uint64_t recordedMicros;
+
+static bool recordIdentify(void) {
+  // identify and count, as a door does after an unlock
+  sensor.placeFinger(features);
+  recorder.flushLog();        // whatever a failed run left behind
+  transcript.bytes.clear();
+  uint64_t start = nativeMicros64();
+  if (recorded.identify() != FINGERPRINT_OK || recorded.getTemplateCount() != FINGERPRINT_OK) return false;
+  recordedMicros = nativeMicros64() - start;
+  recorder.flushLog();
+  return recorded.fingerID == BENCH_MATCHPAGE;
+}
+
+static bool replayIdentify(uint8_t speed) {
+  Adafruit_Fingerprint_Replay line(&transcript.bytes[0], transcript.bytes.size(), speed);
+  Adafruit_Fingerprint player = Adafruit_Fingerprint(&line);
+  if (player.identify() != FINGERPRINT_OK) return false;
+  if (player.fingerID != recorded.fingerID || player.confidence != recorded.confidence) return false;
+  if (player.getTemplateCount() != FINGERPRINT_OK || player.templateCount != recorded.templateCount) return false;
+  return line.done() && !line.mismatches();
+}
+
+static bool runReplay(void) {
+  uint64_t start = nativeMicros64();
+  if (!replayIdentify(1)) return false;
+  // the recorded timing, give or take a millisecond of polling
+  int64_t drift = (int64_t)(nativeMicros64() - start) - (int64_t)recordedMicros;
+  return drift > -2000 && drift < 2000;
+}
+
+static bool runReplayFast(void) {
+  return replayIdentify(4);
+}
+
+static Adafruit_Fingerprint_SlotMap<BENCH_CAPACITY> slots;
+
+static bool runSlotMap(void) {
+  if (slots.load(finger) != FINGERPRINT_OK) return false;
+  // hot copies take pages but are not templates of their own
+  uint16_t copies = 0;
+  for (uint16_t page = BENCH_HOTFIRST; page < BENCH_CAPACITY; page++)
+    copies += hotSet.isCopy(page);
+  if (finger.getTemplateCount() != FINGERPRINT_OK || slots.count() != finger.templateCount + copies) return false;
+
+  uint16_t used = 0;
+  for (uint16_t id = slots.nextUsed(0); id < BENCH_CAPACITY; id = slots.nextUsed(id + 1)) {
+    if (!sensor.getTemplate(id)) return false;
+    used++;
+  }
+  // pages 0, 3, 6, ... plus the benchmark's own are taken; 1 is the first hole
+  uint16_t free = slots.nextFree();
+  if (used != slots.count() || free != 1 || sensor.getTemplate(free)) return false;
+  slots.markUsed(free);
+  return slots.nextFree() == 2;
+}
+
+static bool runBeginUpgrade(void) {
+  // probes 9600 first, finds the module at 57600 and moves it to 115200
+  return finger.begin(9600, 115200) == 115200 && sensor.baudRate() == 115200;
+}
+
+static bool runPacketSize256(void) {
+  return finger.setPacketSize(256) == FINGERPRINT_OK &&
+         finger.getParameters() == FINGERPRINT_OK &&
+         finger.packetLength == 256 && finger.capacity == BENCH_CAPACITY;
+}
+
+static bool runPacketSize32(void) {
+  return finger.setPacketSize(32) == FINGERPRINT_OK && finger.packetLength == 32;
+}
+
+static bool runExportIndexed(void) {
+  // the 35-byte index table ACK is longer than a data packet now, and
+  // must still be read: probing would LOAD every page
+  uint32_t before = sensor.commandsHandled;
+  if (!runExportLibrary()) return false;
+  return sensor.commandsHandled - before < BENCH_CAPACITY;
+}
+
+// a module at the far end of a pseudo-terminal, the way a USB-TTL adapter
+// shows up on a Linux gateway; the bench serves it from yield()
+static R301T_Simulator ptySensor(BENCH_CAPACITY, BENCH_BAUD);
+static int ptyMaster = -1;
+static char ptyPath[64];
+static Adafruit_Fingerprint_Termios ptyLine(ptyPath);
+static Adafruit_Fingerprint ptyFinger = Adafruit_Fingerprint(&ptyLine);
+
+static void servePty(void) {
+  // the module only hears the host at the rate the tty is set to
+  static const struct { speed_t code; uint32_t baud; } rates[] = {
+    { B9600, 9600 }, { B19200, 19200 }, { B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 },
+  };
+  static speed_t speed = B0;
+  struct termios tty;
+  if (tcgetattr(ptyMaster, &tty) == 0 && cfgetospeed(&tty) != speed) {
+    speed = cfgetospeed(&tty);
+    for (uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+      if (rates[i].code == speed)
+        ptySensor.begin(rates[i].baud);
+  }
+
+  uint8_t buffer[256];
+  ssize_t n;
+  while ((n = read(ptyMaster, buffer, sizeof(buffer))) > 0)
+    ptySensor.write(buffer, n);
+  for (n = 0; n < (ssize_t)sizeof(buffer) && ptySensor.available(); n++)
+    buffer[n] = ptySensor.read();
+  if (n > 0 && write(ptyMaster, buffer, n) != n)
+    printf("pty: reply lost\n");
+}
+
+static bool ptyOpened(void) {
+  // from here on the clock is real: the kernel moves the bytes
+  ptyMaster = posix_openpt(O_RDWR | O_NOCTTY);
+  if (ptyMaster < 0 || grantpt(ptyMaster) || unlockpt(ptyMaster) ||
+      ptsname_r(ptyMaster, ptyPath, sizeof(ptyPath)))
+    return false;
+  fcntl(ptyMaster, F_SETFL, fcntl(ptyMaster, F_GETFL) | O_NONBLOCK);
+  nativeRealTime(true);
+  nativeSetYield(servePty);
+  // opens the tty through the transport, as begin() would
+  return ptyFinger.detectBaudRate(BENCH_BAUD) == BENCH_BAUD && ptyLine.isOpen();
+}
+
+static void ptyClosed(void) {
+  nativeSetYield(NULL);
+  nativeRealTime(false);
+  ptyLine.end();
+  if (ptyMaster >= 0)
+    close(ptyMaster);
+}
+
+static bool runPtyVerifyPassword(void) {
+  return ptyFinger.verifyPassword();
+}
+
+static bool runPtyStoreTemplate(void) {
+  if (ptyFinger.storeTemplate(BENCH_MATCHPAGE + 2, features) != FINGERPRINT_OK) return false;
+  const uint8_t *stored = ptySensor.getTemplate(BENCH_MATCHPAGE + 2);
+  return stored && memcmp(stored, features, sizeof(features)) == 0;
+}
+
+static bool runPtyUpgrade(void) {
+  // the transport reopens the tty at the new rate
+  return ptyFinger.setBaudRate(115200) == FINGERPRINT_OK && ptySensor.baudRate() == 115200 &&
+         ptyFinger.verifyPassword();
+}
+
+static bool runPtyUpload(void) {
+  uint8_t buffer[FINGERPRINT_TEMPLATESIZE];
+  if (ptyFinger.loadModel(BENCH_MATCHPAGE + 2) != FINGERPRINT_OK) return false;
+  if (ptyFinger.uploadModel(buffer, sizeof(buffer)) != FINGERPRINT_OK) return false;
+  return memcmp(buffer, features, sizeof(buffer)) == 0;
+}
+
+static const Benchmark benchmarks[] = {
+  { "verifyPassword",        200, 6000,   noSetup,   runVerifyPassword },
+  { "getTemplateCount",      200, 5000,   noSetup,   runTemplateCount },
+  { "structured round trip", 200, 5000,   noSetup,   runStructuredRoundTrip },
+  { "getImage (no finger)",  100, 35000,  fingerOff, runNoFinger },
+  { "replay identify (1x)",   20, 345000, recordIdentify, runReplay },
+  { "replay identify (4x)",   20, 90000,  recordIdentify, runReplayFast },
+  { "identify (3 commands)",  20, 370000, fingerOn,  runIdentify },
+  { "identify (poll)",        20, 370000, fingerOn,  runIdentifyAsync },
+  { "identify()",             20, 345000, fingerOn,  runIdentifyOneCommand },
+  { "identify() (fallback)",  20, 370000, fingerOn,  runIdentifyFallback },
+  { "verify (1:1)",           20, 360000, fingerOn,  runVerify },
+  { "verify (wrong claim)",   20, 360000, fingerOn,  runVerifyOther },
+  { "search (16 pages)",     100, 50000,  fingerScanned, runSearchPartition },
+  { "search (page 901)",      20, 285000,  highFingerScanned, runSearchHighPage },
+  { "hot set search (hit)",   20, 10000,  hotSetPromoted, runHotSetHit },
+  { "hot set search (miss)",  20, 55000,  fingerScanned, runHotSetMiss },
+  { "setAddress (and back)",  20, 20000,  noSetup,   runSetAddress },
+  { "manager (2 sensors)",    20, 480000, bothFingersOn, runManager },
+  { "manager, finger held",    5, 980000, bothFingersOn, runManagerHeld },
+  { "loadModel",             100, 20000,  noSetup,   runLoad },
+  { "storeModel",            100, 40000,  noSetup,   runStore },
+  { "storeTemplate (buffer)", 50, 150000, noSetup,   runStoreTemplate },
+  { "storeTemplate (source)", 50, 150000, noSetup,   runStoreTemplateSource },
+  { "storeTemplate (packets)", 50, 150000, noSetup,   runStructuredDownload },
+  { "storeTemplateBank (2)",  20, 290000, noSetup,   runStoreBank },
+  { "storeTemplateRLE_P",     50, 150000, packRunFeatures, runStoreRLE },
+  { "load + uploadModel",     50, 150000, noSetup,   runUploadModel },
+  { "getImage + uploadImage",  2, 7100000, fingerOn,  runUploadImage },
+  { "uploadImage (bound port)", 2, 7100000, fingerOn, runUploadImageBound },
+  { "load + uploadModel (bound)", 50, 150000, noSetup, runUploadModelBound },
+  { "begin (probe, upgrade)",  1, 1250000, noSetup,  runBeginUpgrade },
+  { "verifyPassword @115200", 200, 3000,   noSetup,   runVerifyPassword },
+  { "storeTemplate @115200",   50, 90000,  noSetup,   runStoreTemplate },
+  { "load + upload @115200",   50, 70000,  noSetup,   runUploadModel },
+  { "exportLibrary @115200",    1, 25000000, noSetup, runExportLibrary },
+  { "export (probing)",         1, 36000000, noSetup, runExportProbing },
+  { "SlotMap load (4 tables)", 20, 30000,  noSetup,   runSlotMap },
+  { "setPacketSize(256)",      1, 10000,  noSetup,   runPacketSize256 },
+  { "storeTemplate @256 B",    50, 88000,  noSetup,   runStoreTemplate },
+  { "load + upload @256 B",    50, 68000,  noSetup,   runUploadModel },
+  { "setPacketSize(32)",        1, 10000,  noSetup,   runPacketSize32 },
+  { "SlotMap load @32 B",      20, 30000,  noSetup,   runSlotMap },
+  { "exportLibrary @32 B",      1, 30000000, noSetup, runExportIndexed },
+  // real time from here on, see ptyOpened(); budgets leave room for the host
+  { "pty verifyPassword",      50, 15000,  ptyOpened, runPtyVerifyPassword },
+  { "pty storeTemplate",       10, 250000, noSetup,   runPtyStoreTemplate },
+  { "pty load + upload",       10, 250000, noSetup,   runPtyUpload },
+  { "pty setBaudRate(115200)",  1, 50000,  noSetup,   runPtyUpgrade },
+  { "pty storeTemplate @115200", 10, 150000, noSetup,  runPtyStoreTemplate },
+};
+
+static uint32_t wireBytes(void) {
+  return sensor.bytesIn + sensor.bytesOut + exitSensor.bytesIn + exitSensor.bytesOut +
+         ptySensor.bytesIn + ptySensor.bytesOut;
+}
+
+static uint32_t wireFrames(void) {
+  return sensor.framesIn + sensor.framesOut + exitSensor.framesIn + exitSensor.framesOut +
+         ptySensor.framesIn + ptySensor.framesOut;
+}
+
+static bool runBenchmark(const Benchmark &b) {
+  if (!b.setup()) {
+    printf("%-24s setup failed\n", b.name);
+    return false;
+  }
+
+  uint32_t bytesBefore = wireBytes();
+  uint32_t framesBefore = wireFrames();
+  uint64_t startVirtual = nativeMicros64();
+  std::chrono::steady_clock::time_point startHost = std::chrono::steady_clock::now();
+
+  for (uint16_t i = 0; i < b.iterations; i++) {
+    if (!b.run()) {
+      printf("%-24s failed on iteration %u\n", b.name, i);
+      return false;
+    }
+  }
+
+  double hostNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startHost).count();
+  double elapsed = (double)(nativeMicros64() - startVirtual);
+  double perOp = elapsed / b.iterations;
+  uint32_t bytes = wireBytes() - bytesBefore;
+  uint32_t frames = wireFrames() - framesBefore;
+  bool withinBudget = perOp <= b.budget;
+
+  // replays answer without waiting and without the sensor, so may take no time or bytes
+  printf("%-24s %5u ops %10.1f us/op %8.1f ops/s %8.1f us/frame %9.1f B/s %8.0f host ns/op  %s\n",
+         b.name, b.iterations, perOp, perOp ? 1e6 / perOp : 0.0, frames ? elapsed / frames : 0.0,
+         elapsed ? bytes * 1e6 / elapsed : 0.0,
+         hostNs / b.iterations, withinBudget ? "ok" : "OVER BUDGET");
+  return withinBudget;
+}
+
+int main(void) {
+  makeFeatures(features, BENCH_MATCHPAGE);
+  for (uint16_t page = 0; page < BENCH_CAPACITY; page += 3) {
+    uint8_t other[R301T_TEMPLATE_SIZE];
+    makeFeatures(other, page + BENCH_CAPACITY);
+    sensor.setTemplate(page, other);
+  }
+  sensor.setTemplate(BENCH_MATCHPAGE, features);
+  exitSensor.setTemplate(BENCH_MATCHPAGE, features);
+
+  finger.begin(BENCH_BAUD);
+  exitFinger.begin(BENCH_BAUD);
+  if (!finger.verifyPassword() || !exitFinger.verifyPassword()) {
+    printf("Did not find simulated fingerprint sensor :(\n");
+    return 1;
+  }
+
+  bool ok = true;
+  for (uint8_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    ok = runBenchmark(benchmarks[i]) && ok;
+  ptyClosed();
+
+  printf("RLE template: %u of %u bytes of flash\n", (unsigned)packedLength, (unsigned)sizeof(runFeatures));
+  printf("loop() passes while identify (poll) waited: %u\n", (unsigned)loopPasses);
+#ifdef FINGERPRINT_STATS
+  finger.printStats(Serial);
+#endif
+#ifdef FINGERPRINT_TRACE
+  // a damaged header byte and the retry as seen on the wire, for
+  // tools/trace_decode.py
+  CaptureStream trace;
+  finger.drainTrace(trace);
+  trace.bytes.clear();
+  sensor.corruptNextFrame(6);
+  ok = finger.getTemplateCount() == FINGERPRINT_PACKETRECIEVEERR && ok;
+  ok = finger.getTemplateCount() == FINGERPRINT_OK && ok;
+  finger.drainTrace(trace);
+  FILE *file = fopen("native_trace.bin", "wb");
+  if (file) {
+    fwrite(&trace.bytes[0], 1, trace.bytes.size(), file);
+    fclose(file);
+  }
+  printf("wire trace: %u bytes in native_trace.bin\n", (unsigned)trace.bytes.size());
+#endif
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/***************************************************
+  Framing regressions for the `native` environment: Adafruit_Fingerprint
+  against the simulated R301T module, with scripted line faults. Each
+  damaged reply must fail its own command only, so the next one starts
+  clean.
+
+    pio test -e native
+ ****************************************************/
+
+#include <Arduino.h>
+#include <custom_adafruit_fingerprint.h>
+#include <r301t_simulator.h>
+#include <unity.h>
+
+#define TEST_CAPACITY 1000
+#define TEST_BAUD 57600
+#define TEST_MATCHPAGE 100
+
+static R301T_Simulator sensor(TEST_CAPACITY, TEST_BAUD);
+static Adafruit_Fingerprint finger = Adafruit_Fingerprint(&sensor);
+static uint8_t features[R301T_TEMPLATE_SIZE];
+
+void setUp(void) {
+  // whatever a failed test left behind
+  sensor.liftFinger();
+  sensor.autoIdentify = true;
+  sensor.identifySilent = false;
+}
+
+void tearDown(void) {
+}
+
+static void test_structured_round_trip(void) {
+  uint8_t data[] = { FINGERPRINT_TEMPLATECOUNT };
+  Adafruit_Fingerprint_SizedPacket<sizeof(data)> command(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+  Adafruit_Fingerprint_SizedPacket<3> ack;
+  finger.writeStructuredPacket(command);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getStructuredPacket(&ack));
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_ACKPACKET, ack.type);
+  TEST_ASSERT_EQUAL_UINT16(3, ack.length);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, ack.data[0]);
+  TEST_ASSERT_EQUAL_UINT16(1, ((uint16_t)ack.data[1] << 8) | ack.data[2]);
+}
+
+static void test_reply_timeout(void) {
+  // nothing was asked, so nothing comes
+  Adafruit_Fingerprint_SizedPacket<3> ack;
+  uint64_t start = nativeMicros64();
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_TIMEOUT, finger.getStructuredPacket(&ack, 20));
+  TEST_ASSERT_UINT32_WITHIN(1000, 20000, (uint32_t)(nativeMicros64() - start));
+}
+
+static void test_noisy_reply(void) {
+  sensor.injectNoise(5);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+}
+
+static void test_false_start_code(void) {
+  // a stray EF 01 right ahead of the ACK, then one after some garbage
+  sensor.injectNoise(0, true);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+  sensor.injectNoise(3, true);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+}
+
+static void test_bad_checksum(void) {
+  sensor.corruptNextFrame(10);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, finger.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+}
+
+static void test_bad_header(void) {
+  sensor.corruptNextFrame(6);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, finger.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+}
+
+static void test_truncated_reply(void) {
+  // a damaged length byte promises more payload than ever arrives
+  sensor.corruptNextFrame(8);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, finger.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+}
+
+static void test_identify_damaged_ack(void) {
+  // a line error on the first Identify ACK does not switch to the fallback
+  Adafruit_Fingerprint fresh = Adafruit_Fingerprint(&sensor);
+  sensor.placeFinger(features);
+  sensor.corruptNextFrame(10);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, fresh.identify());
+  uint32_t before = sensor.commandsHandled;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, fresh.identify());
+  TEST_ASSERT_EQUAL_UINT16(TEST_MATCHPAGE, fresh.fingerID);
+  TEST_ASSERT_EQUAL_UINT32(1, sensor.commandsHandled - before);
+}
+
+static void test_identify_refused(void) {
+  // firmware without Identify refuses it with an intact ACK, once
+  Adafruit_Fingerprint fresh = Adafruit_Fingerprint(&sensor);
+  sensor.placeFinger(features);
+  sensor.autoIdentify = false;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, fresh.identify());
+  uint32_t before = sensor.commandsHandled;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, fresh.identify());
+  TEST_ASSERT_EQUAL_UINT32(3, sensor.commandsHandled - before);
+}
+
+static void test_identify_ignored(void) {
+  // firmware that never answers Identify costs a timeout per call until
+  // FINGERPRINT_IDENTIFYTIMEOUTS calls in a row went unanswered
+  Adafruit_Fingerprint fresh = Adafruit_Fingerprint(&sensor);
+  sensor.placeFinger(features);
+  sensor.identifySilent = true;
+  for (uint8_t i = 1; i < FINGERPRINT_IDENTIFYTIMEOUTS; i++)
+    TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, fresh.identify());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, fresh.identify());
+  TEST_ASSERT_EQUAL_UINT16(TEST_MATCHPAGE, fresh.fingerID);
+  uint32_t before = sensor.commandsHandled;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, fresh.identify());
+  TEST_ASSERT_EQUAL_UINT32(3, sensor.commandsHandled - before);
+}
+
+static void test_blocking_after_begin(void) {
+  // a blocking call finishes the command still in flight before its own
+  finger.templateCount = 0;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.beginTemplateCount());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_NOFINGER, finger.getImage());
+  TEST_ASSERT_EQUAL_UINT16(1, finger.templateCount);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.beginGetImage());
+  TEST_ASSERT_TRUE(finger.verifyPassword());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.status());
+}
+
+static void test_index_table_small_packets(void) {
+  // the 35-byte ReadIndexTable ACK is longer than a 32-byte data packet
+  uint8_t bitmap[FINGERPRINT_INDEXTABLESIZE];
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.setPacketSize(32));
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.readIndexTable(0, bitmap));
+  TEST_ASSERT_EQUAL_UINT8(0x01, bitmap[TEST_MATCHPAGE / 8] >> (TEST_MATCHPAGE % 8) & 0x01);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.setPacketSize(FINGERPRINT_DEFAULTPACKETSIZE));
+}
+
+int main(void) {
+  for (uint16_t i = 0; i < sizeof(features); i++)
+    features[i] = (uint8_t)(TEST_MATCHPAGE * 31 + i * 7);
+  sensor.setTemplate(TEST_MATCHPAGE, features);
+  finger.begin(TEST_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_structured_round_trip);
+  RUN_TEST(test_reply_timeout);
+  RUN_TEST(test_noisy_reply);
+  RUN_TEST(test_false_start_code);
+  RUN_TEST(test_bad_checksum);
+  RUN_TEST(test_bad_header);
+  RUN_TEST(test_truncated_reply);
+  RUN_TEST(test_identify_damaged_ack);
+  RUN_TEST(test_identify_refused);
+  RUN_TEST(test_identify_ignored);
+  RUN_TEST(test_blocking_after_begin);
+  RUN_TEST(test_index_table_small_packets);
+  return UNITY_END();
+}
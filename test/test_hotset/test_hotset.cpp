@@ -0,0 +1,124 @@
+/***************************************************
+  Hot set regressions for the `native` environment: the copies that
+  Adafruit_Fingerprint_HotSet keeps in its partition must not show up as
+  templates of their own anywhere a page number or a count is reported.
+
+    pio test -e native
+ ****************************************************/
+
+#include <Arduino.h>
+#include <custom_adafruit_fingerprint.h>
+#include <r301t_simulator.h>
+#include <unity.h>
+
+#include <vector>
+
+#define TEST_CAPACITY 1000
+#define TEST_BAUD 57600
+#define TEST_HOTFIRST 0         ///< Below the regular, so a full search meets the copy first
+#define TEST_REGULARPAGE 500
+#define TEST_OTHERPAGE 200
+
+static R301T_Simulator sensor(TEST_CAPACITY, TEST_BAUD);
+static Adafruit_Fingerprint finger = Adafruit_Fingerprint(&sensor);
+static Adafruit_Fingerprint_HotSet<8> hotSet;
+static uint8_t regular[R301T_TEMPLATE_SIZE];
+static uint8_t other[R301T_TEMPLATE_SIZE];
+
+///! Host end of the backup link: keeps what it is sent
+class CaptureStream : public Print {
+ public:
+  size_t write(uint8_t c) { bytes.push_back(c); return 1; }
+  size_t write(const uint8_t *buffer, size_t size) {
+    bytes.insert(bytes.end(), buffer, buffer + size);
+    return size;
+  }
+  using Print::write;
+  std::vector<uint8_t> bytes;
+};
+
+void setUp(void) {
+  sensor.placeFinger(regular);
+}
+
+void tearDown(void) {
+}
+
+static void test_promoted(void) {
+  TEST_ASSERT_TRUE(hotSet.isHot(TEST_REGULARPAGE));
+  TEST_ASSERT_NOT_NULL(sensor.getTemplate(TEST_HOTFIRST));
+  TEST_ASSERT_TRUE(hotSet.isCopy(TEST_HOTFIRST));
+  TEST_ASSERT_FALSE(hotSet.isCopy(TEST_HOTFIRST + 1));
+  TEST_ASSERT_EQUAL_UINT16(TEST_REGULARPAGE, hotSet.translate(TEST_HOTFIRST));
+  TEST_ASSERT_EQUAL_UINT16(TEST_OTHERPAGE, hotSet.translate(TEST_OTHERPAGE));
+}
+
+static void test_identify_reports_own_page(void) {
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.identify());
+  TEST_ASSERT_EQUAL_UINT16(TEST_REGULARPAGE, finger.fingerID);
+}
+
+static void test_fast_search_reports_own_page(void) {
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getImage());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.image2Tz());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.fingerFastSearch());
+  TEST_ASSERT_EQUAL_UINT16(TEST_REGULARPAGE, finger.fingerID);
+  // the hot set itself still finds it in the partition
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, hotSet.search());
+  TEST_ASSERT_EQUAL_UINT16(TEST_REGULARPAGE, finger.fingerID);
+}
+
+static void test_count_leaves_copies_out(void) {
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT16(2, finger.templateCount);
+}
+
+static void test_export_skips_partition(void) {
+  CaptureStream host;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.exportLibrary(host));
+  TEST_ASSERT_EQUAL_UINT16(2, finger.templateCount);
+
+  // walk the records: magic, page, length-prefixed blocks, 0, sum
+  std::vector<uint16_t> pages;
+  size_t i = 0;
+  while (i + 3 <= host.bytes.size()) {
+    TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_BACKUPMAGIC, host.bytes[i]);
+    uint16_t page = ((uint16_t)host.bytes[i + 1] << 8) | host.bytes[i + 2];
+    i += 3;
+    if (page == FINGERPRINT_BACKUPEND)
+      break;
+    while (i < host.bytes.size() && host.bytes[i])
+      i += host.bytes[i] + 1u;
+    i += 3;
+    pages.push_back(page);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2, pages.size());
+  TEST_ASSERT_EQUAL_UINT16(TEST_OTHERPAGE, pages[0]);
+  TEST_ASSERT_EQUAL_UINT16(TEST_REGULARPAGE, pages[1]);
+}
+
+int main(void) {
+  for (uint16_t i = 0; i < sizeof(regular); i++) {
+    regular[i] = (uint8_t)(TEST_REGULARPAGE * 31 + i * 7);
+    other[i] = (uint8_t)(TEST_OTHERPAGE * 31 + i * 7);
+  }
+  sensor.setTemplate(TEST_REGULARPAGE, regular);
+  sensor.setTemplate(TEST_OTHERPAGE, other);
+  finger.begin(TEST_BAUD);
+
+  // one match out in the library, then promotion into the partition
+  hotSet.begin(finger, TEST_HOTFIRST);
+  sensor.placeFinger(regular);
+  finger.getImage();
+  finger.image2Tz();
+  hotSet.search();
+  hotSet.maintain();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_promoted);
+  RUN_TEST(test_identify_reports_own_page);
+  RUN_TEST(test_fast_search_reports_own_page);
+  RUN_TEST(test_count_leaves_copies_out);
+  RUN_TEST(test_export_skips_partition);
+  return UNITY_END();
+}
@@ -0,0 +1,106 @@
+/***************************************************
+  Record and replay regressions for the `native` environment: sessions
+  with the simulated R301T module captured by Adafruit_Fingerprint_Recorder
+  and played back to the library by Adafruit_Fingerprint_Replay, whole,
+  cut short, and with a damaged reply in them.
+
+    pio test -e native
+ ****************************************************/
+
+#include <Arduino.h>
+#include <custom_adafruit_fingerprint.h>
+#include <r301t_simulator.h>
+#include <unity.h>
+
+#include <vector>
+
+#define TEST_CAPACITY 1000
+#define TEST_BAUD 57600
+#define TEST_MATCHPAGE 100
+
+///! Where the recorder's blocks go
+class CaptureStream : public Print {
+ public:
+  size_t write(uint8_t c) { bytes.push_back(c); return 1; }
+  size_t write(const uint8_t *buffer, size_t size) {
+    bytes.insert(bytes.end(), buffer, buffer + size);
+    return size;
+  }
+  using Print::write;
+  std::vector<uint8_t> bytes;
+};
+
+static R301T_Simulator sensor(TEST_CAPACITY, TEST_BAUD);
+static CaptureStream transcript;
+static Adafruit_Fingerprint_Recorder recorder(&sensor, &transcript);
+static Adafruit_Fingerprint recorded = Adafruit_Fingerprint(&recorder);
+static uint8_t features[R301T_TEMPLATE_SIZE];
+
+void setUp(void) {
+  recorder.flushLog();        // whatever a failed test left behind
+  transcript.bytes.clear();
+}
+
+void tearDown(void) {
+}
+
+static void recordIdentify(void) {
+  // identify and count, as a door does after an unlock
+  sensor.placeFinger(features);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, recorded.identify());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, recorded.getTemplateCount());
+  recorder.flushLog();
+  sensor.liftFinger();
+}
+
+static void test_replay_whole(void) {
+  recordIdentify();
+  Adafruit_Fingerprint_Replay line(&transcript.bytes[0], transcript.bytes.size(), 0);
+  Adafruit_Fingerprint player = Adafruit_Fingerprint(&line);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, player.identify());
+  TEST_ASSERT_EQUAL_UINT16(recorded.fingerID, player.fingerID);
+  TEST_ASSERT_EQUAL_UINT16(recorded.confidence, player.confidence);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, player.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT16(recorded.templateCount, player.templateCount);
+  TEST_ASSERT_TRUE(line.done());
+  TEST_ASSERT_EQUAL_UINT32(0, line.mismatches());
+}
+
+static void test_replay_cut_short(void) {
+  // the capture ends inside the count's ACK: a partial frame, then a timeout
+  recordIdentify();
+  Adafruit_Fingerprint_Replay line(&transcript.bytes[0], transcript.bytes.size() - 4 * 6, 0);
+  Adafruit_Fingerprint player = Adafruit_Fingerprint(&line);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, player.identify());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, player.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT32(0, line.mismatches());
+}
+
+static void test_replay_truncated_reply(void) {
+  // a damaged length byte, captured, fails the same way when played back
+  sensor.corruptNextFrame(8);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, recorded.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, recorded.getTemplateCount());
+  recorder.flushLog();
+
+  Adafruit_Fingerprint_Replay line(&transcript.bytes[0], transcript.bytes.size(), 0);
+  Adafruit_Fingerprint player = Adafruit_Fingerprint(&line);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, player.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, player.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT16(recorded.templateCount, player.templateCount);
+  TEST_ASSERT_TRUE(line.done());
+  TEST_ASSERT_EQUAL_UINT32(0, line.mismatches());
+}
+
+int main(void) {
+  for (uint16_t i = 0; i < sizeof(features); i++)
+    features[i] = (uint8_t)(TEST_MATCHPAGE * 31 + i * 7);
+  sensor.setTemplate(TEST_MATCHPAGE, features);
+  sensor.begin(TEST_BAUD);    // begin() cannot open the port through the recorder
+
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_whole);
+  RUN_TEST(test_replay_cut_short);
+  RUN_TEST(test_replay_truncated_reply);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+/***************************************************
+  DOWNLOAD and UPLOAD regressions for the `native` environment: templates
+  and images moved in data packets between Adafruit_Fingerprint and the
+  simulated R301T module, intact and with the faults a real line has.
+
+    pio test -e native
+ ****************************************************/
+
+#include <Arduino.h>
+#include <custom_adafruit_fingerprint.h>
+#include <r301t_simulator.h>
+#include <unity.h>
+
+#include <vector>
+
+#define TEST_CAPACITY 1000
+#define TEST_BAUD 57600
+#define TEST_MATCHPAGE 100
+
+static R301T_Simulator sensor(TEST_CAPACITY, TEST_BAUD);
+static Adafruit_Fingerprint finger = Adafruit_Fingerprint(&sensor);
+static uint8_t features[R301T_TEMPLATE_SIZE];
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+  finger.setPacketSize(FINGERPRINT_DEFAULTPACKETSIZE);
+}
+
+static void assertStored(uint16_t page) {
+  const uint8_t *stored = sensor.getTemplate(page);
+  TEST_ASSERT_NOT_NULL(stored);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(features, stored, sizeof(features));
+}
+
+static uint16_t patternSource(uint8_t *buffer, uint16_t len, void *context) {
+  uint16_t *offset = (uint16_t *)context;
+  memcpy(buffer, features + *offset, len);
+  *offset += len;
+  return len;
+}
+
+static uint16_t shortSource(uint8_t *buffer, uint16_t len, void *context) {
+  // runs dry after 200 bytes
+  uint16_t *offset = (uint16_t *)context;
+  uint16_t n = *offset + len > 200 ? (*offset < 200 ? 200 - *offset : 0) : len;
+  memcpy(buffer, features + *offset, n);
+  *offset += n;
+  return n;
+}
+
+static void checksumSink(const uint8_t *data, uint16_t len, void *context) {
+  uint32_t *sum = (uint32_t *)context;
+  while (len--) *sum += *data++;
+}
+
+///! Host end of the backup link: keeps what it is sent
+class CaptureStream : public Print {
+ public:
+  size_t write(uint8_t c) { bytes.push_back(c); return 1; }
+  size_t write(const uint8_t *buffer, size_t size) {
+    bytes.insert(bytes.end(), buffer, buffer + size);
+    return size;
+  }
+  using Print::write;
+  std::vector<uint8_t> bytes;
+};
+
+static void test_store_template_buffer(void) {
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.storeTemplate(TEST_MATCHPAGE + 2, features));
+  assertStored(TEST_MATCHPAGE + 2);
+}
+
+static void test_store_template_source(void) {
+  uint16_t offset = 0;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.storeTemplate(TEST_MATCHPAGE + 3, patternSource, &offset));
+  assertStored(TEST_MATCHPAGE + 3);
+}
+
+static void test_store_template_packets(void) {
+  // whole 128-byte data frames built as packets rather than streamed
+  uint8_t data[] = { FINGERPRINT_DOWNLOAD, 0x01 };
+  Adafruit_Fingerprint_SizedPacket<sizeof(data)> command(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+  Adafruit_Fingerprint_SizedPacket<1> ack;
+  finger.writeStructuredPacket(command);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getStructuredPacket(&ack));
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, ack.data[0]);
+
+  for (uint16_t offset = 0; offset < sizeof(features); offset += FINGERPRINT_DEFAULTPACKETSIZE) {
+    bool last = offset + FINGERPRINT_DEFAULTPACKETSIZE >= (uint16_t)sizeof(features);
+    Adafruit_Fingerprint_SizedPacket<FINGERPRINT_DEFAULTPACKETSIZE> frame(
+      last ? FINGERPRINT_ENDDATAPACKET : FINGERPRINT_DATAPACKET, FINGERPRINT_DEFAULTPACKETSIZE, features + offset);
+    finger.writeStructuredPacket(frame);
+  }
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.storeModel(TEST_MATCHPAGE + 4));
+  assertStored(TEST_MATCHPAGE + 4);
+}
+
+static void test_download_source_runs_dry(void) {
+  uint8_t before[R301T_TEMPLATE_SIZE];
+  for (uint16_t i = 0; i < sizeof(before); i++)
+    before[i] = (uint8_t)(i * 13);
+  sensor.setTemplate(TEST_MATCHPAGE + 8, before);
+  uint16_t offset = 0;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRESPONSEFAIL, finger.storeTemplate(TEST_MATCHPAGE + 8, shortSource, &offset));
+  // the padded template is not stored, and the sensor is still in step
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(before, sensor.getTemplate(TEST_MATCHPAGE + 8), sizeof(before));
+  TEST_ASSERT_TRUE(finger.verifyPassword());
+}
+
+static void test_upload_model(void) {
+  uint8_t buffer[FINGERPRINT_TEMPLATESIZE];
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.loadModel(TEST_MATCHPAGE));
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.uploadModel(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_UINT16(sizeof(buffer), finger.transferLength);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(features, buffer, sizeof(buffer));
+}
+
+static void test_upload_bad_packet(void) {
+  // the first data packet after the UPLOAD ACK fails its checksum
+  uint8_t buffer[FINGERPRINT_TEMPLATESIZE];
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.loadModel(TEST_MATCHPAGE));
+  sensor.corruptNextFrame(FINGERPRINT_HEADERSIZE + 5, 1);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_BADPACKET, finger.uploadModel(buffer, sizeof(buffer)));
+  // all packets were drained, so the retry lines up
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.uploadModel(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(features, buffer, sizeof(buffer));
+}
+
+static void test_upload_start_code_in_payload(void) {
+  // EF 01 inside a template is payload, not the next frame
+  uint8_t marked[R301T_TEMPLATE_SIZE], buffer[FINGERPRINT_TEMPLATESIZE];
+  memcpy(marked, features, sizeof(marked));
+  for (uint16_t i = 0; i + 1u < sizeof(marked); i += 50) {
+    marked[i] = FINGERPRINT_STARTCODE >> 8;
+    marked[i + 1] = FINGERPRINT_STARTCODE & 0xFF;
+  }
+  sensor.setTemplate(TEST_MATCHPAGE + 9, marked);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.loadModel(TEST_MATCHPAGE + 9));
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.uploadModel(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(marked, buffer, sizeof(buffer));
+}
+
+static void test_upload_image(void) {
+  uint32_t sum = 0;
+  sensor.placeFinger(features);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getImage());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.uploadImage(checksumSink, &sum));
+  TEST_ASSERT_EQUAL_UINT16(R301T_IMAGE_SIZE, finger.transferLength);
+  sensor.liftFinger();
+}
+
+static void test_small_packets(void) {
+  uint8_t buffer[FINGERPRINT_TEMPLATESIZE];
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.setPacketSize(32));
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.storeTemplate(TEST_MATCHPAGE + 10, features));
+  assertStored(TEST_MATCHPAGE + 10);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.loadModel(TEST_MATCHPAGE + 10));
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.uploadModel(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(features, buffer, sizeof(buffer));
+}
+
+static void test_export_small_packets(void) {
+  // the index table is still read, rather than every page probed with LOAD
+  CaptureStream host;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.setPacketSize(32));
+  uint32_t before = sensor.commandsHandled;
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.exportLibrary(host));
+  uint16_t records = finger.templateCount;
+  TEST_ASSERT_LESS_THAN_UINT32(TEST_CAPACITY, sensor.commandsHandled - before);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_OK, finger.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT16(finger.templateCount, records);
+}
+
+int main(void) {
+  for (uint16_t i = 0; i < sizeof(features); i++)
+    features[i] = (uint8_t)(TEST_MATCHPAGE * 31 + i * 7);
+  sensor.setTemplate(TEST_MATCHPAGE, features);
+  finger.begin(TEST_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_store_template_buffer);
+  RUN_TEST(test_store_template_source);
+  RUN_TEST(test_store_template_packets);
+  RUN_TEST(test_download_source_runs_dry);
+  RUN_TEST(test_upload_model);
+  RUN_TEST(test_upload_bad_packet);
+  RUN_TEST(test_upload_start_code_in_payload);
+  RUN_TEST(test_upload_image);
+  RUN_TEST(test_small_packets);
+  RUN_TEST(test_export_small_packets);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Receive a template library backup sent by Adafruit_Fingerprint::exportLibrary().
+
+Reads the binary backup stream from a serial port (needs pyserial) or from a
+file captured earlier, checks every record and writes each template to
+<output>/<page>.bin, the layout tools/template_bank_gen.py reads.
+
+Stream format, all numbers MSB first:
+
+    0xA5  page(2)  { n(1) data(n) }*  0x00  sum(2)
+
+where sum is the 16-bit sum of the two page bytes and all data bytes. A
+record for page 0xFFFF with no data closes the stream.
+
+    tools/backup_receive.py /dev/ttyUSB0 -b 115200 --trigger B -o backup/
+    tools/backup_receive.py capture.bin -o backup/
+"""
+
+import argparse
+import os
+import sys
+
+MAGIC = 0xA5
+END = 0xFFFF
+
+
+class Reader:
+    def __init__(self, source):
+        self.source = source
+
+    def byte(self):
+        b = self.source.read(1)
+        if not b:
+            raise EOFError('stream ended inside a record')
+        return b[0]
+
+    def u16(self):
+        return (self.byte() << 8) | self.byte()
+
+    def read(self, n):
+        data = bytearray()
+        while len(data) < n:
+            chunk = self.source.read(n - len(data))
+            if not chunk:
+                raise EOFError('stream ended inside a record')
+            data.extend(chunk)
+        return bytes(data)
+
+
+def receive(source, output, quiet=False):
+    reader = Reader(source)
+    good = bad = 0
+
+    # skip whatever the sketch printed before the backup starts
+    while True:
+        b = source.read(1)
+        if not b:
+            raise EOFError('no backup found in the stream')
+        if b[0] == MAGIC:
+            break
+
+    while True:
+        page = reader.u16()
+        total = (page >> 8) + (page & 0xFF)
+        data = bytearray()
+        while True:
+            n = reader.byte()
+            if not n:
+                break
+            block = reader.read(n)
+            total += sum(block)
+            data.extend(block)
+        checksum = reader.u16()
+
+        if page == END:
+            break
+        if checksum != total & 0xFFFF:
+            bad += 1
+            if not quiet:
+                sys.stderr.write('page %d: bad checksum, skipped\n' % page)
+        else:
+            good += 1
+            with open(os.path.join(output, '%d.bin' % page), 'wb') as f:
+                f.write(data)
+            if not quiet:
+                sys.stderr.write('page %d: %d bytes\n' % (page, len(data)))
+
+        if reader.byte() != MAGIC:
+            raise ValueError('lost record framing after page %d' % page)
+
+    return good, bad
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('source', help='serial port or captured stream file')
+    parser.add_argument('-o', '--output', default='backup', help='directory for the <page>.bin files')
+    parser.add_argument('-b', '--baud', type=int, default=115200, help='serial baud rate')
+    parser.add_argument('--trigger', help='bytes to send to start the backup, e.g. B')
+    parser.add_argument('-q', '--quiet', action='store_true', help='only print the summary')
+    args = parser.parse_args()
+
+    os.makedirs(args.output, exist_ok=True)
+    if os.path.isfile(args.source):
+        source = open(args.source, 'rb')
+    else:
+        import serial  # pyserial, only needed for live capture
+        source = serial.Serial(args.source, args.baud, timeout=5)
+        if args.trigger:
+            source.write(args.trigger.encode('ascii'))
+
+    try:
+        good, bad = receive(source, args.output, args.quiet)
+    except (EOFError, ValueError) as e:
+        sys.exit('%s: %s' % (args.source, e))
+    finally:
+        source.close()
+
+    print('%d templates saved to %s, %d bad' % (good, args.output, bad))
+    sys.exit(1 if bad else 0)
+
+
+if __name__ == '__main__':
+    main()
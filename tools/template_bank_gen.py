@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""Turn a directory of exported fingerprint templates into a PROGMEM bank header.
+
+Each template is run-length coded in the format the library's
+storeTemplateRLE_P() decoder streams from flash:
+
+    control < 0x80   control + 1 literal bytes follow
+    control >= 0x80  the next byte repeats (control & 0x7F) + 3 times
+
+Templates that do not shrink are emitted raw. Input files are either raw
+binary (*.bin, as tools/backup_receive.py writes them) or text holding
+just the 512 bytes as two-digit hex with separators ("0xEF, 0x01, ..."
+or "EF 01 ..."). The extractor sketch in src/main.cpp prints a template
+that way, 16 bytes a line; copy those 32 lines into a file.
+A file named after a number (5.bin, 12.txt) is stored at that library
+page; the others get consecutive pages starting at --first-id.
+
+    tools/template_bank_gen.py exported/ -o include/template_bank.h
+"""
+
+import argparse
+import os
+import re
+import sys
+
+TEMPLATE_SIZE = 512
+MAX_LITERAL = 0x80
+MIN_RUN = 3
+MAX_RUN = 0x7F + MIN_RUN
+
+
+def read_template(path):
+    with open(path, 'rb') as f:
+        raw = f.read()
+    if not path.endswith('.bin'):
+        text = raw.decode('ascii', 'replace')
+        raw = bytes(int(h, 16) for h in re.findall(r'\b(?:0x)?([0-9A-Fa-f]{2})\b', text))
+    if len(raw) != TEMPLATE_SIZE:
+        sys.exit('%s: %d bytes, expected %d' % (path, len(raw), TEMPLATE_SIZE))
+    return raw
+
+
+def rle_encode(data):
+    out = bytearray()
+    literal = bytearray()
+
+    def flush():
+        if literal:
+            out.append(len(literal) - 1)
+            out.extend(literal)
+            del literal[:]
+
+    i = 0
+    while i < len(data):
+        run = 1
+        while i + run < len(data) and data[i + run] == data[i] and run < MAX_RUN:
+            run += 1
+        if run >= MIN_RUN:
+            flush()
+            out.append(0x80 | (run - MIN_RUN))
+            out.append(data[i])
+            i += run
+        else:
+            literal.append(data[i])
+            if len(literal) == MAX_LITERAL:
+                flush()
+            i += 1
+    flush()
+    return bytes(out)
+
+
+def rle_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        control = data[i]
+        if control & 0x80:
+            out.extend(data[i + 1:i + 2] * ((control & 0x7F) + MIN_RUN))
+            i += 2
+        else:
+            out.extend(data[i + 1:i + 2 + control])
+            i += control + 2
+    return bytes(out)
+
+
+def c_array(data, indent='  ', per_line=16):
+    lines = []
+    for offset in range(0, len(data), per_line):
+        lines.append(indent + ', '.join('0x%02X' % b for b in data[offset:offset + per_line]) + ',')
+    return '\n'.join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('directory', help='directory of exported templates')
+    parser.add_argument('-o', '--output', default='-', help='header to write (default: stdout)')
+    parser.add_argument('-n', '--name', default='templateBank', help='C name of the bank array')
+    parser.add_argument('--first-id', type=int, default=1, help='page for templates not named by number')
+    args = parser.parse_args()
+
+    files = sorted(f for f in os.listdir(args.directory)
+                   if os.path.isfile(os.path.join(args.directory, f)) and not f.startswith('.'))
+    if not files:
+        sys.exit('%s: no templates found' % args.directory)
+
+    entries = []
+    used = set()
+    next_id = args.first_id
+    for name in files:
+        stem = os.path.splitext(name)[0]
+        if stem.isdigit():
+            page = int(stem)
+        else:
+            while next_id in used:
+                next_id += 1
+            page = next_id
+        if page in used:
+            sys.exit('%s: page %d is already taken' % (name, page))
+        used.add(page)
+
+        raw = read_template(os.path.join(args.directory, name))
+        packed = rle_encode(raw)
+        assert rle_decode(packed) == raw
+        if len(packed) < len(raw):
+            entries.append((page, name, packed, 'FINGERPRINT_TEMPLATE_RLE'))
+        else:
+            entries.append((page, name, raw, 'FINGERPRINT_TEMPLATE_RAW'))
+
+    guard = re.sub(r'\W', '_', os.path.basename(args.output) if args.output != '-' else args.name).upper()
+    total_raw = TEMPLATE_SIZE * len(entries)
+    total_packed = sum(len(e[2]) for e in entries)
+
+    out = []
+    out.append('// Generated by tools/template_bank_gen.py from %s, do not edit.' % args.directory)
+    out.append('// %d templates, %d bytes of flash instead of %d.' % (len(entries), total_packed, total_raw))
+    out.append('#ifndef %s' % guard)
+    out.append('#define %s' % guard)
+    out.append('')
+    out.append('#include <custom_adafruit_fingerprint.h>')
+    out.append('')
+    for page, name, data, _ in entries:
+        out.append('// %s: %d -> %d bytes' % (name, TEMPLATE_SIZE, len(data)))
+        out.append('static const uint8_t %s_%d[] PROGMEM = {' % (args.name, page))
+        out.append(c_array(data))
+        out.append('};')
+        out.append('')
+    out.append('static const Adafruit_Fingerprint_Template %s[] PROGMEM = {' % args.name)
+    for page, _, _, encoding in entries:
+        out.append('  { %d, %s_%d, %d, %s },' % (page, args.name, page, TEMPLATE_SIZE, encoding))
+    out.append('};')
+    out.append('')
+    count = guard[:-2] if guard.endswith('_H') else guard
+    out.append('#define %s_COUNT (sizeof(%s) / sizeof(%s[0]))' % (count, args.name, args.name))
+    out.append('')
+    out.append('#endif')
+    text = '\n'.join(out) + '\n'
+
+    if args.output == '-':
+        sys.stdout.write(text)
+    else:
+        with open(args.output, 'w') as f:
+            f.write(text)
+        sys.stderr.write('%s: %d templates, %d -> %d bytes\n' % (args.output, len(entries), total_raw, total_packed))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Checks for trace_decode.py: python3 -m unittest discover -s tools"""
+
+import io
+import unittest
+
+import trace_decode
+
+
+def frame(kind, payload):
+    length = len(payload) + 2
+    body = bytes([kind, length >> 8, length & 0xFF]) + bytes(payload)
+    total = sum(body) & 0xFFFF
+    return b'\xef\x01\xff\xff\xff\xff' + body + bytes([total >> 8, total & 0xFF])
+
+
+def split(data):
+    splitter = trace_decode.FrameSplitter('<-')
+    pieces = []
+    for i, value in enumerate(data):
+        done = splitter.feed(i, value)
+        if done:
+            pieces.append(done[1])
+    pending = splitter.flush()
+    if pending:
+        pieces.append(pending[1])
+    return pieces
+
+
+def block(entries):
+    out = bytearray([trace_decode.MAGIC, len(entries) >> 8, len(entries) & 0xFF, 0, 0])
+    for time, kind, value in entries:
+        out += time.to_bytes(4, 'big') + bytes([kind, value])
+    return bytes(out)
+
+
+class FrameSplitterTest(unittest.TestCase):
+
+    def test_start_code_inside_payload(self):
+        data = frame(0x02, [0x10, 0xEF, 0x01, 0x20, 0xEF, 0x01]) + frame(0x08, [0xEF, 0x01])
+        self.assertEqual(split(data), [data[:17], data[17:]])
+
+    def test_noise_ahead_of_frame(self):
+        ack = frame(0x07, [0x00])
+        self.assertEqual(split(b'\x55\xef' + ack), [b'\x55\xef', ack])
+
+    def test_false_start_code(self):
+        # a stray EF 01 whose "header" makes no sense is noise, the real frame follows
+        ack = frame(0x07, [0x00, 0x00, 0x05])
+        self.assertEqual(split(b'\xef\x01' + ack), [b'\xef\x01', ack])
+
+    def test_decode_data_packet(self):
+        data = frame(0x02, [0xEF, 0x01] * 16)
+        out = io.StringIO()
+        trace_decode.decode(io.BytesIO(block([(i, trace_decode.RX, b) for i, b in enumerate(data)])), out)
+        self.assertEqual(out.getvalue().split('\n')[:-1], ['     0.000 ms <- data 32 bytes'])
+
+
+if __name__ == '__main__':
+    unittest.main()
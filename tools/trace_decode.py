@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""Pretty-print a UART trace drained by Adafruit_Fingerprint::drainTrace().
+
+The library must be built with FINGERPRINT_TRACE. Each drained block is
+
+    0x7E  count(2)  lost(2)  { time(4) kind(1) value(1) }*count
+
+all numbers MSB first, time in micros(). Kinds: 1 byte sent, 2 byte
+received, 3 received frame complete (value 0 good, 0xFE bad checksum),
+4 frame dropped for a corrupt header (value is the offending byte),
+5 timeout. Sent and received bytes are reassembled into frames:
+
+    tools/trace_decode.py trace.bin
+    tools/trace_decode.py /dev/ttyUSB0 -b 115200 --trigger T
+
+Adafruit_Fingerprint_Recorder writes the same blocks, with no markers.
+Anything before the first block (the sketch's own prints) is skipped.
+"""
+
+import argparse
+import os
+import sys
+
+MAGIC = 0x7E
+TX, RX, FRAME, DROP, TIMEOUT = 1, 2, 3, 4, 5
+
+MAX_LENGTH = 256 + 2  # length field of the largest data packet: payload and checksum
+PACKET_TYPES = {0x01: 'cmd', 0x02: 'data', 0x07: 'ack', 0x08: 'end'}
+COMMANDS = {
+    0x01: 'GETIMAGE', 0x02: 'IMAGE2TZ', 0x03: 'MATCH', 0x05: 'REGMODEL',
+    0x06: 'STORE', 0x07: 'LOAD', 0x08: 'UPLOAD', 0x09: 'DOWNLOAD',
+    0x0A: 'UPIMAGE', 0x0C: 'DELETE', 0x0D: 'EMPTY', 0x0E: 'SETSYSPARA',
+    0x0F: 'READSYSPARA', 0x11: 'IDENTIFY', 0x12: 'SETPASSWORD',
+    0x13: 'VERIFYPASSWORD', 0x15: 'SETADDRESS', 0x1B: 'HISPEEDSEARCH',
+    0x1D: 'TEMPLATECOUNT', 0x1F: 'READINDEX',
+}
+CODES = {
+    0x00: 'OK', 0x01: 'PACKETRECIEVEERR', 0x02: 'NOFINGER', 0x03: 'IMAGEFAIL',
+    0x06: 'IMAGEMESS', 0x07: 'FEATUREFAIL', 0x08: 'NOMATCH', 0x09: 'NOTFOUND',
+    0x0A: 'ENROLLMISMATCH', 0x0B: 'BADLOCATION', 0x0C: 'DBRANGEFAIL',
+    0x0D: 'UPLOADFEATUREFAIL', 0x0E: 'PACKETRESPONSEFAIL', 0x0F: 'UPLOADFAIL',
+    0x10: 'DELETEFAIL', 0x11: 'DBCLEARFAIL', 0x13: 'PASSFAIL',
+    0x15: 'INVALIDIMAGE', 0x18: 'FLASHERR', 0x1A: 'INVALIDREG',
+    0xFE: 'BADPACKET', 0xFF: 'TIMEOUT',
+}
+
+
+def read_exact(source, n):
+    data = bytearray()
+    while len(data) < n:
+        chunk = source.read(n - len(data))
+        if not chunk:
+            raise EOFError('trace ended inside a block')
+        data.extend(chunk)
+    return bytes(data)
+
+
+def read_blocks(source):
+    """Yield (lost, entries) per block; entries are (time, kind, value)."""
+    while True:
+        b = source.read(1)
+        if not b:
+            return
+        if b[0] != MAGIC:
+            continue
+        head = read_exact(source, 4)
+        count = (head[0] << 8) | head[1]
+        lost = (head[2] << 8) | head[3]
+        raw = read_exact(source, 6 * count)
+        entries = []
+        for i in range(0, len(raw), 6):
+            time = int.from_bytes(raw[i:i + 4], 'big')
+            entries.append((time, raw[i + 4], raw[i + 5]))
+        yield lost, entries
+
+
+class FrameSplitter:
+    """Collect the bytes of one direction into EF01 frames."""
+
+    def __init__(self, name):
+        self.name = name
+        self.buf = bytearray()
+        self.times = []
+
+    def feed(self, time, value):
+        """Add a byte; returns (start time, bytes) when a frame or a run of noise ends."""
+        self.buf.append(value)
+        self.times.append(time)
+        if self.buf[:2] != b'\xef\x01':
+            # between frames: bytes ahead of a start code are noise
+            if self.buf[-2:] == b'\xef\x01':
+                return self.take(len(self.buf) - 2)
+            return None
+        if len(self.buf) < 9:
+            return None
+        length = (self.buf[7] << 8) | self.buf[8]
+        if self.buf[6] in PACKET_TYPES and 2 <= length <= MAX_LENGTH:
+            # templates and images hold EF 01 too; the header says where the frame ends
+            return self.take(len(self.buf)) if len(self.buf) == 9 + length else None
+        # a false start code: noise up to the next one
+        start = self.buf.find(b'\xef\x01', 2)
+        if start < 0:
+            start = len(self.buf) - 1 if self.buf[-1] == 0xEF else len(self.buf)
+        return self.take(start)
+
+    def take(self, n):
+        done = (self.times[0], bytes(self.buf[:n]))
+        del self.buf[:n]
+        del self.times[:n]
+        return done
+
+    def flush(self):
+        return self.take(len(self.buf)) if self.buf else None
+
+
+def describe(frame):
+    if len(frame) < 11 or frame[:2] != b'\xef\x01':
+        return 'noise ' + frame.hex(' ')
+    kind = frame[6]
+    payload = frame[9:-2]
+    total = sum(frame[6:-2]) & 0xFFFF
+    sum_ok = total == ((frame[-2] << 8) | frame[-1])
+    name = PACKET_TYPES.get(kind, 'type %02x' % kind)
+    if kind == 0x01 and payload:
+        detail = COMMANDS.get(payload[0], 'op %02x' % payload[0])
+        if len(payload) > 1:
+            detail += ' ' + payload[1:].hex(' ')
+    elif kind == 0x07 and payload:
+        detail = CODES.get(payload[0], 'code %02x' % payload[0])
+        if len(payload) > 1:
+            detail += ' ' + payload[1:].hex(' ')
+    else:
+        detail = '%d bytes' % len(payload)
+    if frame[2:6] != b'\xff\xff\xff\xff':
+        detail = '@%s %s' % (frame[2:6].hex(), detail)
+    return '%-4s %s%s' % (name, detail, '' if sum_ok else '  [bad checksum]')
+
+
+def decode(source, out):
+    origin = None
+    # frames carry over from block to block: a recorder writes one every few dozen bytes
+    splitters = {TX: FrameSplitter('->'), RX: FrameSplitter('<-')}
+    blocks = read_blocks(source)
+    while True:
+        block = next(blocks, None)
+        lines = []
+        if block is None or block[0]:
+            for splitter in splitters.values():
+                pending = splitter.flush()
+                if pending:
+                    lines.append((pending[0], '%s partial %s' % (splitter.name, pending[1].hex(' '))))
+            write_lines(out, lines, origin)
+            lines = []
+        if block is None:
+            return
+        lost, entries = block
+        if lost:
+            out.write('-- %d older entries were overwritten\n' % lost)
+        for time, kind, value in entries:
+            if origin is None:
+                origin = time
+            if kind in splitters:
+                done = splitters[kind].feed(time, value)
+                if done:
+                    lines.append((done[0], '%s %s' % (splitters[kind].name, describe(done[1]))))
+            elif kind == FRAME:
+                if value:
+                    lines.append((time, '   frame rejected: %s' % CODES.get(value, '%02x' % value)))
+            elif kind == DROP:
+                pending = splitters[RX].flush()
+                if pending:
+                    lines.append((pending[0], '<- dropped ' + pending[1].hex(' ')))
+                lines.append((time, '   resync: bad header byte 0x%02x' % value))
+            elif kind == TIMEOUT:
+                lines.append((time, '   timeout'))
+            else:
+                lines.append((time, '   unknown entry %d 0x%02x' % (kind, value)))
+        write_lines(out, lines, origin)
+
+
+def write_lines(out, lines, origin):
+    # frames are complete only at their last byte; list them by their first
+    lines.sort(key=lambda line: (line[0] - origin) & 0xFFFFFFFF)
+    for time, text in lines:
+        # micros() wraps every 71 minutes
+        out.write('%10.3f ms %s\n' % (((time - origin) & 0xFFFFFFFF) / 1000.0, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('source', help='serial port or captured trace file')
+    parser.add_argument('-b', '--baud', type=int, default=115200, help='serial baud rate')
+    parser.add_argument('--trigger', help='bytes to send to make the sketch call drainTrace()')
+    args = parser.parse_args()
+
+    if os.path.isfile(args.source):
+        source = open(args.source, 'rb')
+    else:
+        import serial  # pyserial, only needed for live capture
+        source = serial.Serial(args.source, args.baud, timeout=5)
+        if args.trigger:
+            source.write(args.trigger.encode('ascii'))
+
+    try:
+        decode(source, sys.stdout)
+    except EOFError as e:
+        sys.exit('%s: %s' % (args.source, e))
+    finally:
+        source.close()
+
+
+if __name__ == '__main__':
+    main()